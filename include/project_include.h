@@ -22,10 +22,46 @@ Include file for Assignment 1
 #define BUS_MST_SW 0
 #define BUS_MST_HW 1
 
+//Request slots preallocated per bus master
+#ifndef BUS_MAX_OUTSTANDING
+#define BUS_MAX_OUTSTANDING 4
+#endif
+
+//Width of the on-chip bus data path in bits (32, 64, 128 or 256)
+#ifndef BUS_DATA_WIDTH
+#define BUS_DATA_WIDTH 32
+#endif
+
+//Depth in words of the asynchronous FIFO between the internal bus and the DRAM in the Cross_Bus
+#ifndef CROSS_BUS_FIFO_DEPTH
+#define CROSS_BUS_FIFO_DEPTH 64
+#endif
+
+//Largest stream prefetch buffer of the Cross_Bus in words (-p)
+#ifndef CROSS_BUS_MAX_PREFETCH_WORDS
+#define CROSS_BUS_MAX_PREFETCH_WORDS 65536
+#endif
+
+//Largest posted-write buffer of the Cross_Bus in words (-b)
+#ifndef CROSS_BUS_MAX_WRITE_BUFFER_WORDS
+#define CROSS_BUS_MAX_WRITE_BUFFER_WORDS 65536
+#endif
+
+//Words per split read when the CC streams from DRAM with split transactions
+#ifndef SPLIT_READ_CHUNK
+#define SPLIT_READ_CHUNK 256
+#endif
+
+//Most detailed log level compiled in: 0 error, 1 warn, 2 info, 3 debug, 4 trace (see sim_log.h)
+#ifndef SIM_LOG_LEVEL
+#define SIM_LOG_LEVEL 3
+#endif
+
 #define OP_READ 5
 #define OP_WRITE 6
 #define OP_HW_MUL 7
 #define OP_HW_STAT 8
+#define OP_READ_SPLIT 9
 
 //Defines for hardware block
 #define STATUS_IP 9
@@ -33,12 +69,65 @@ Include file for Assignment 1
 
 
 /** </INTERNAL DEFINES> **/
+//Test images preloaded into DRAM, -n streams any range of the test set instead
 #define TEST_IMAGES 1000
 
+//Slots of the DRAM ring the dataset loader streams test images through
+#ifndef DATASET_RING_SLOTS
+#define DATASET_RING_SLOTS 4
+#endif
+
 /** <EXTERNAL DEFINES> **/
 #define DRAM_BASE_ADDR 1024
 #define DRAM_SIZE 0x08000000
 
+//Clock periods in ns of the on-chip (internal) and DRAM (external) clocks
+#define INT_CLK_PERIOD_NS 0.5
+#define EXT_CLK_PERIOD_NS 20
+
+//DRAM access cost in external clock cycles
+#define DRAM_READ_CYCLES 2
+#define DRAM_WRITE_CYCLES 1
+
+//Bank and row-buffer geometry and timing (external clock cycles) of the DRAM bank model
+#ifndef DRAM_BANKS
+#define DRAM_BANKS 8
+#endif
+#ifndef DRAM_ROW_WORDS
+#define DRAM_ROW_WORDS 512
+#endif
+#ifndef DRAM_TRCD
+#define DRAM_TRCD 1
+#endif
+#ifndef DRAM_TCL
+#define DRAM_TCL 1
+#endif
+#ifndef DRAM_TCWL
+#define DRAM_TCWL 1
+#endif
+#ifndef DRAM_TRP
+#define DRAM_TRP 1
+#endif
+#ifndef DRAM_TRAS
+#define DRAM_TRAS 2
+#endif
+
+//Most DRAM channels behind the Cross_Bus, each a DRAM module with its own bank state
+#ifndef DRAM_MAX_CHANNELS
+#define DRAM_MAX_CHANNELS 8
+#endif
+
+//Default geometry of the optional cache in the Cross_Bus, in bytes
+#ifndef CACHE_SIZE_BYTES
+#define CACHE_SIZE_BYTES 32768
+#endif
+#ifndef CACHE_WAYS
+#define CACHE_WAYS 4
+#endif
+#ifndef CACHE_LINE_BYTES
+#define CACHE_LINE_BYTES 64
+#endif
+
 #define NUM_LAYERS 6
 
 #define LAYER_SIZES {784, 2500, 2000, 1500, 1000, 500, 10};
@@ -47,6 +136,11 @@ Include file for Assignment 1
 #define NUM_ACCELERATORS 4
 #endif
 
+//Most CPU/CC pairs sharing the bus and DRAM, their CC status registers fill the addresses below DRAM_BASE_ADDR
+#ifndef EIE_MAX_TENANTS
+#define EIE_MAX_TENANTS 4
+#endif
+
 #define EIE_CC_BASE_ADDR 0
 #define EIE_CC_ADDR_SIZE 0x100
 #define EIE_CC_ADDR_OP 0
@@ -58,10 +152,16 @@ Include file for Assignment 1
 #define EIE_CC_ADDR_OUTREADY 6
 #define EIE_CC_ADDR_OP_COMPLETE 7
 #define EIE_CC_ADDR_PREDICTED_LABEL 8
+//Non-zero to have the CC keep the predicted label of every image for EIE_CC_OP_WRITE_RESULTS
+#define EIE_CC_ADDR_RESULTS 9
 
 #define EIE_CC_OP_WRITE_WEIGHT 1
 #define EIE_CC_OP_WRITE_INPUT 2
 #define EIE_CC_OP_READ_OUTPUT 3
+//Write the predicted labels kept so far as one burst to EIE_CC_ADDR_DATA and start over
+#define EIE_CC_OP_WRITE_RESULTS 4
+//Labels and predicted labels in the batched results arrays are bytes, packed from the low end of a word
+#define EIE_RESULTS_PER_WORD 4
 
 /** </EXTERNAL DEFINES> **/
 
@@ -73,12 +173,26 @@ Include file for Assignment 1
 
 /** <Interface and Class definitions> **/
 
+//Tools that share the headers without SystemC (golden_model) define EIE_NO_SYSTEMC
+#ifndef EIE_NO_SYSTEMC
+
 //Definition of the virtual class, overwrite the implementations
 class simple_mem_if : virtual public sc_interface
 {
   public:
     virtual bool Write(unsigned int addr, unsigned int data) = 0;
     virtual bool Read(unsigned int addr, unsigned int& data) = 0;
+    //len consecutive words from addr as one DRAM burst
+    virtual bool WriteBurst(unsigned int addr, const unsigned int *data, unsigned int len) = 0;
+    virtual bool ReadBurst(unsigned int addr, unsigned int *data, unsigned int len) = 0;
+    //Untimed accesses for loosely-timed callers, the caller accounts for the latency
+    virtual bool Peek(unsigned int addr, unsigned int& data) = 0;
+    virtual bool Poke(unsigned int addr, unsigned int data) = 0;
+    //Backing store of the word at addr and how many words follow it contiguously, NULL if unmapped
+    virtual unsigned int *DirectPointer(unsigned int addr, unsigned int &len) = 0;
+    //External clock cycles of an access to len consecutive words starting at addr, for callers
+    //that wait (or annotate) themselves. Advances the DRAM state as if the access took place.
+    virtual unsigned int AccessCycles(unsigned int addr, bool write, unsigned int len) = 0;
 };
 
 // Bus Master Interface
@@ -89,6 +203,12 @@ class bus_master_if : virtual public sc_interface
     virtual bool WaitForAcknowledge(unsigned int mst_id) = 0;
     virtual void ReadData(unsigned int &data) = 0;
     virtual void WriteData(unsigned int data) = 0;
+    //Pipelined multi-word transfers, paired with a minion burst of the same length
+    virtual void ReadBurst(unsigned int *data, unsigned int len) = 0;
+    virtual void WriteBurst(const unsigned int *data, unsigned int len) = 0;
+    //Split reads: post a tagged read, collect its data later (false if the read was dropped)
+    virtual unsigned int RequestRead(unsigned int mst_id, unsigned int addr, unsigned int len) = 0;
+    virtual bool ReadResponse(unsigned int tag, unsigned int *data, unsigned int len) = 0;
 };
 
 
@@ -96,12 +216,29 @@ class bus_master_if : virtual public sc_interface
 class bus_minion_if : virtual public sc_interface
 {
   public:
-    virtual void Listen(unsigned int &req_addr, unsigned int &req_op, unsigned int &req_len) = 0;
+    //Blocks until the bus grants a request decoded to this minion (see bus_clocked::attach_minion)
+    virtual void Listen(unsigned int minion_id, unsigned int &req_addr, unsigned int &req_op, unsigned int &req_len) = 0;
     virtual void Acknowledge() = 0; 
     virtual void SendReadData(unsigned int data) = 0;
     virtual void ReceiveWriteData(unsigned int &data) = 0;
+    //Pipelined multi-word transfers, paired with a master burst of the same length
+    virtual void SendReadBurst(const unsigned int *data, unsigned int len) = 0;
+    virtual void ReceiveWriteBurst(unsigned int *data, unsigned int len) = 0;
+    //Split reads: accept the address (frees the bus), return the data later by tag
+    virtual unsigned int AcceptRead() = 0;
+    virtual void SendResponse(unsigned int tag, const unsigned int *data, unsigned int len) = 0;
+};
+
+// Coherence Interface of a path that keeps copies of DRAM words (cache tags, prefetched data)
+class dram_coherence_if : virtual public sc_interface
+{
+  public:
+    //len words from addr were rewritten in the backing store behind the bus, e.g. by the host
+    virtual void HostWrite(unsigned int addr, unsigned int len) = 0;
 };
 
+#endif
+
 /** </Interface and Class definitions> **/
 
 
@@ -1,6 +1,11 @@
 #include "systemc.h"
 #include "project_include.h"
 #include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <sys/mman.h>
+#include "dram_image.h"
+#include "sim_log.h"
 
 /**
 Class DRAM implements SC_MODULE and SIMPLE_MEM_IF. The latter interface is from
@@ -13,109 +18,334 @@ The only caveat is that any module that is accessing the DRAM MUST BE A
 SC_THREAD! This is because the Read() and Write() functions need to have
 wait() statements inside of them sensitive to the clock. Otherwise the 
 module will wait forever without any triggers. 
+
+The backing store is an anonymous private mapping of the whole
+DRAM_SIZE words, reserved without swap. The kernel hands out a
+page only when it is first written and untouched pages read as
+zeros from the shared zero page, so startup does not depend on
+DRAM_SIZE and the resident size follows the data actually used.
+The store stays one contiguous array for DirectPointer (DMI).
+
+The weights and the test set are preloaded from their source
+files (dram_preload.h) or, much faster, mapped in from a binary
+image built by dram_image_convert (dram_image.h). An image can
+hold the weights packed (weight_codec.h), which packed_weights
+reports so the CPU looks for them through the directory.
+The labels of a preloaded test set are copied once more into
+a contiguous array right after it, at test_labels_offset, for
+batched results. When the test set is streamed
+(dataset_loader.h) only the weights are preloaded and
+test_set_offset tells the loader where its ring goes.
+
+By default every read costs DRAM_READ_CYCLES and every write
+DRAM_WRITE_CYCLES, whatever the access pattern. 
+
+BANK MODEL:
+	enable_banks() switches to a model with DRAM_BANKS banks of
+	DRAM_ROW_WORDS-word rows, addressed row:bank:column, and
+	one row buffer per bank. An access to the open row costs
+	tCL (tCWL for writes). An access to a closed bank first
+	activates the row (tRCD), one to another row first
+	precharges the open one (tRP), no earlier than tRAS after
+	its activation. Every further word of a burst costs one
+	cycle, and a burst that crosses into the next row pays
+	for opening that row as well.
+	
+	With the open-page policy rows stay open until a conflict.
+	With the closed-page policy every access auto-precharges,
+	so every access activates and the bank is busy for tRP
+	afterwards. The DRAM keeps its own command timeline, which
+	never runs behind simulation time and runs ahead of it for
+	loosely-timed callers, so the same costs come out for pin-
+	level and annotated accesses.
+	
+	Activates, precharges and words read or written are
+	tallied separately for the energy split in eie_main.
+
+CHANNELS:
+	A multi-channel memory is one DRAM module per channel, all
+	bound to the Cross_Bus, which interleaves the address
+	space across them. The first channel owns the backing
+	store and preloads it, the others are built on top of it
+	and only ever touch the words interleaved to them, so the
+	store and DirectPointer stay as with one channel while
+	every channel keeps its own bank state and timeline.
+	set_interleave() tells a channel which words it holds;
+	the bank model then addresses rows by the channel's own
+	word offset, so a channel's consecutive interleave units
+	share its rows.
 **/
 class DRAM : public sc_module, public simple_mem_if {
 	
 	private:
-		unsigned int main_memory[DRAM_SIZE];
-		char correctLabels[TEST_IMAGES];
+		unsigned int *main_memory; //sparse, see above
+		bool owns_store;           //false for the other channels of a multi-channel memory
+		
+		//interleaving, channel of channels in units of interleave_words
+		unsigned int channel;
+		unsigned int channels;
+		unsigned int interleave_words;
+		
+		//row buffer of one bank, times are external cycles on the DRAM timeline
+		struct dram_bank {
+			bool open;
+			unsigned int row;
+			unsigned long long activated_at;
+			unsigned long long ready_at; //end of the last precharge
+		};
+		bool bank_model;
+		bool open_page;
+		std::vector<dram_bank> banks;
+		unsigned long long timeline; //cycle at which the last access finished
+		
+		unsigned long long current_cycle(){
+			return (unsigned long long) (sc_time_stamp() / sc_time(EXT_CLK_PERIOD_NS, SC_NS));
+		}
+		
+		//Offset of a word among the words of this channel
+		unsigned int channel_offset(unsigned int offset){
+			if(channels == 1){
+				return offset;
+			}
+			return offset / (interleave_words * channels) * interleave_words + offset % interleave_words;
+		}
+		
 	public:
+		//bank model tallies
+		unsigned long long tally_activates;
+		unsigned long long tally_precharges;
+		unsigned long long tally_row_hits;
+		unsigned long long tally_row_misses;    //bank was closed
+		unsigned long long tally_row_conflicts; //another row was open
+		unsigned long long tally_words;
+		
+		//the weights are in the packed layout of weight_codec.h
+		bool packed_weights;
+		
+		//word offset of the test set, right after the weights, and of its labels array after it
+		unsigned int test_set_offset;
+		unsigned int test_labels_offset;
 
 		sc_in_clk clk;
 		
 		SC_HAS_PROCESS(DRAM);
 		
-		//Constructor
-		DRAM(sc_module_name name) : sc_module(name) {
-			cout << "DRAM has been instantiated with name *" << name << endl;
+		/*
+		Constructor, preloads from the binary image if one is given, from the source files otherwise.
+		A further channel of a multi-channel memory passes the first one as shared and uses its
+		preloaded backing store. Without with_test_set only the weights are preloaded from the
+		source files, the test set is streamed in later (dataset_loader.h).
+		*/
+		DRAM(sc_module_name name, const std::string &image = "", DRAM *shared = NULL, bool with_test_set = true) : sc_module(name) {
+			LOG_INFO(LOG_DRAM, "DRAM has been instantiated with name *" << name);
+			
+			channel = 0;
+			channels = 1;
+			interleave_words = DRAM_ROW_WORDS;
+			bank_model = false;
+			open_page = true;
+			timeline = 0;
+			tally_activates = 0;
+			tally_precharges = 0;
+			tally_row_hits = 0;
+			tally_row_misses = 0;
+			tally_row_conflicts = 0;
+			tally_words = 0;
+			packed_weights = false;
+			test_set_offset = 0;
+			test_labels_offset = 0;
+			
+			if(shared != NULL){
+				main_memory = shared->main_memory;
+				packed_weights = shared->packed_weights;
+				test_set_offset = shared->test_set_offset;
+				test_labels_offset = shared->test_labels_offset;
+				owns_store = false;
+				return;
+			}
+			owns_store = true;
 
-			//initialize the memory
-			for(int i = 0; i < DRAM_SIZE; i++){
-				main_memory[i] = 0;
+			//reserve the memory, pages are zero until they are written
+			void *store = mmap(NULL, (size_t) DRAM_SIZE * sizeof(unsigned int), PROT_READ | PROT_WRITE,
+			                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			if(store == MAP_FAILED){
+				SC_REPORT_FATAL(this->name(), "cannot reserve the DRAM backing store");
 			}
+			main_memory = (unsigned int *) store;
 			
-			unsigned int base_addr = 0;
-
-			for (int i = 0; i < NUM_LAYERS; i++) {
-				std::string path("Weights/");
-				path += std::string("weight_l") + std::to_string(i) + std::string(".txt");
-				cout << path << endl;
-				
-				ifstream input;
-				input.open(path, ios::in);
-
-				std::vector<unsigned int> tmp;
-				float f;
-				unsigned int ui;
-				while (!input.eof()) {
-					input >> f;
-					ui = *(unsigned int *) &f;
-					tmp.push_back(ui);
+			if(!image.empty()){
+				//binary image from dram_image_convert
+				std::vector<dram_region> regions;
+				std::string error;
+				if(!map_dram_image(image, main_memory, DRAM_SIZE, regions, error)){
+					SC_REPORT_FATAL(this->name(), error.c_str());
 				}
-				cout << "weight layer " << i << " size = " << tmp.size() << endl;
-				input.close();
-				
-				for (int j = 0; j < tmp.size(); j++) {
-					main_memory[base_addr + j] = tmp.at(j);
+				for(unsigned int i = 0; i < regions.size(); i++){
+					LOG_INFO(LOG_DRAM, "image region " << regions[i].name << " at " << regions[i].offset << ", " << regions[i].words << " words");
+					if(regions[i].name == "weight_dir"){
+						packed_weights = true;
+					}
+					if(regions[i].name == "test_set"){
+						test_set_offset = regions[i].offset;
+						if(regions[i].offset + regions[i].words + regions[i].words / MNIST_IMAGE_WORDS / EIE_RESULTS_PER_WORD < DRAM_SIZE){
+							test_labels_offset = preload_test_labels(main_memory, regions[i]).offset;
+						}
+					}
 				}
-				
-				unsigned int layersizes[NUM_LAYERS + 1] = LAYER_SIZES;
-
-				for (int j = 0; j < NUM_ACCELERATORS; j++) {
-					
-					cout << *(float *) &main_memory[base_addr + j * layersizes[i]] << " ";
-					cout << *(float *) &main_memory[base_addr + j * layersizes[i] + 1] << " ";
-					cout << *(float *) &main_memory[base_addr + j * layersizes[i] + 2] << " ";
-					cout << endl;
+				return;
+			}
+			
+			std::vector<dram_region> weights;
+			std::string error;
+			if(!preload_weights(main_memory, DRAM_SIZE, weights, error)){
+				SC_REPORT_FATAL(this->name(), error.c_str());
+			}
+			test_set_offset = weights.back().offset + weights.back().words;
+			if(with_test_set){
+				test_labels_offset = preload_test_labels(main_memory, preload_test_set(main_memory, test_set_offset)).offset;
+			}
+		}
+		
+		~DRAM(){
+			if(owns_store){
+				munmap(main_memory, (size_t) DRAM_SIZE * sizeof(unsigned int));
+			}
+		}
+		
+		//This is channel index of count, holding the interleave units of unit_words words where index == unit % count
+		void set_interleave(unsigned int index, unsigned int count, unsigned int unit_words){
+			channel = index;
+			channels = count > 0 ? count : 1;
+			interleave_words = unit_words > 0 ? unit_words : 1;
+		}
+		
+		//Switch from the fixed access costs to the bank and row-buffer model
+		void enable_banks(bool open_page_policy){
+			bank_model = true;
+			open_page = open_page_policy;
+			dram_bank idle;
+			idle.open = false;
+			idle.row = 0;
+			idle.activated_at = 0;
+			idle.ready_at = 0;
+			banks.assign(DRAM_BANKS, idle);
+		}
+		
+		bool banks_enabled(){
+			return bank_model;
+		}
+		
+		bool open_page_policy(){
+			return open_page;
+		}
+		
+		unsigned int AccessCycles(unsigned int addr, bool write, unsigned int len){
+			if(!bank_model){
+				return (write ? DRAM_WRITE_CYCLES : DRAM_READ_CYCLES) + len - 1;
+			}
+			
+			unsigned long long start = std::max(timeline, current_cycle());
+			unsigned long long t = start;
+			unsigned int offset = addr - DRAM_BASE_ADDR;
+			while(len > 0){
+				//one row at a time, a long burst opens every row it crosses
+				unsigned int local = channel_offset(offset);
+				unsigned int n = std::min(len, DRAM_ROW_WORDS - local % DRAM_ROW_WORDS);
+				if(channels > 1){
+					n = std::min(n, interleave_words - offset % interleave_words);
 				}
-				
-				base_addr += (unsigned int) tmp.size();
+				t = row_access(local, write, n, t);
+				offset += n;
+				len -= n;
 			}
-
-			ifstream imgs, labels;
-			imgs.open("MNIST/t10k-images.idx3-ubyte", ios::in | ios::binary);
-			labels.open("MNIST/t10k-labels.idx1-ubyte", ios::in | ios::binary);
-
-			char imgbuf[28 * 28];
-			char labelbuf[8];
-
-			imgs.read(imgbuf, 16);
-			labels.read(labelbuf, 8);
-			std::ios_base::fmtflags f(cout.flags());
-			for (int i = 0; i < 16; i++) {
-				cout << std::setfill('0') << std::setw(2) << hex << (unsigned int) imgbuf[i] << " ";
-			}
-			cout << endl;
-			for (int i = 0; i < 8; i++) {
-				cout << std::setfill('0') << std::setw(2) << hex << (unsigned int) labelbuf[i] << " ";
-			}
-			cout << endl;
-			cout.flags(f);
-
-			for (unsigned int i = 0; i < TEST_IMAGES; i++) {
-				imgs.read(imgbuf, 28 * 28);
-				labels.read(labelbuf, 1);
-
-				for (int j = 0; j < 28 * 28; j++) {
-					float dimg = (float) (unsigned char) imgbuf[j];
-					dimg = dimg * 2.0f / 255.0f - 1.0f;
-					unsigned int uimg = *(unsigned int *) &dimg;
-					main_memory[base_addr + j] = uimg;
+			timeline = t;
+			return (unsigned int) (t - start);
+		}
+		
+	private:
+		//Access len words inside one row starting at cycle t, returns the cycle the last word is done
+		unsigned long long row_access(unsigned int offset, bool write, unsigned int len, unsigned long long t){
+			dram_bank &bank = banks[(offset / DRAM_ROW_WORDS) % DRAM_BANKS];
+			unsigned int row = offset / DRAM_ROW_WORDS / DRAM_BANKS;
+			
+			if(bank.open && bank.row == row){
+				tally_row_hits++;
+			} else {
+				t = std::max(t, bank.ready_at);
+				if(bank.open){
+					//precharge the open row first, it must have been open for tRAS
+					t = std::max(t, bank.activated_at + DRAM_TRAS) + DRAM_TRP;
+					tally_precharges++;
+					tally_row_conflicts++;
+				} else {
+					tally_row_misses++;
 				}
-				base_addr += 28 * 28;
-				correctLabels[i] = labelbuf[0];
-				main_memory[base_addr] = (unsigned int) (unsigned char) labelbuf[0];
-				base_addr++;
+				bank.activated_at = t;
+				bank.open = true;
+				bank.row = row;
+				t += DRAM_TRCD;
+				tally_activates++;
 			}
-
-			imgs.close();
-			labels.close();
+			t += (write ? DRAM_TCWL : DRAM_TCL) + len - 1;
+			tally_words += len;
+			
+			if(!open_page){
+				//auto-precharge, the bank is busy until it is done
+				bank.ready_at = std::max(t, bank.activated_at + DRAM_TRAS) + DRAM_TRP;
+				bank.open = false;
+				tally_precharges++;
+			}
+			return t;
 		}
 		
+	public:
+		
 		//Write to memory with simple interface
 		bool Write(unsigned int addr, unsigned int data){
-			wait(clk.posedge_event()); //write costs 1 clock cycle
-			//Write to the memory
+			unsigned int cycles = AccessCycles(addr, true, 1);
+			for(unsigned int i = 0; i < cycles; i++){
+				wait(clk.posedge_event()); //write costs DRAM_WRITE_CYCLES clock cycles without the bank model
+			}
+			return Poke(addr, data);
+		}
+		
+		//Read from memory with simple interface
+		bool Read(unsigned int addr, unsigned int& data){
+			unsigned int cycles = AccessCycles(addr, false, 1);
+			for(unsigned int i = 0; i < cycles; i++){
+				wait(clk.posedge_event()); //read costs DRAM_READ_CYCLES clock cycles without the bank model
+			}
+			return Peek(addr, data);
+		}
+		
+		//Write len consecutive words as one burst
+		bool WriteBurst(unsigned int addr, const unsigned int *data, unsigned int len){
+			if(addr < DRAM_BASE_ADDR || addr >= DRAM_BASE_ADDR + DRAM_SIZE || len > DRAM_BASE_ADDR + DRAM_SIZE - addr){
+				return false;
+			}
+			unsigned int cycles = AccessCycles(addr, true, len);
+			for(unsigned int i = 0; i < cycles; i++){
+				wait(clk.posedge_event());
+			}
+			std::copy(data, data + len, &main_memory[addr - DRAM_BASE_ADDR]);
+			return true;
+		}
+		
+		//Read len consecutive words as one burst
+		bool ReadBurst(unsigned int addr, unsigned int *data, unsigned int len){
+			if(addr < DRAM_BASE_ADDR || addr >= DRAM_BASE_ADDR + DRAM_SIZE || len > DRAM_BASE_ADDR + DRAM_SIZE - addr){
+				return false;
+			}
+			unsigned int cycles = AccessCycles(addr, false, len);
+			for(unsigned int i = 0; i < cycles; i++){
+				wait(clk.posedge_event());
+			}
+			std::copy(&main_memory[addr - DRAM_BASE_ADDR], &main_memory[addr - DRAM_BASE_ADDR] + len, data);
+			return true;
+		}
+		
+		//Write to memory without waiting on the clock, used by the loosely-timed bridge
+		bool Poke(unsigned int addr, unsigned int data){
 			if(addr >= DRAM_BASE_ADDR && addr < DRAM_BASE_ADDR + DRAM_SIZE){
 				//write to memory
 				main_memory[addr - DRAM_BASE_ADDR] = data;
@@ -126,10 +356,8 @@ class DRAM : public sc_module, public simple_mem_if {
 			}
 		}
 		
-		//Read from memory with simple interface
-		bool Read(unsigned int addr, unsigned int& data){
-			wait(clk.posedge_event()); wait(clk.posedge_event()); //read costs 2 clock cycles
-			//Read from the memory
+		//Read from memory without waiting on the clock
+		bool Peek(unsigned int addr, unsigned int& data){
 			if(addr >= DRAM_BASE_ADDR && addr < DRAM_BASE_ADDR + DRAM_SIZE){
 				//read to memory
 				data = main_memory[addr - DRAM_BASE_ADDR];
@@ -140,6 +368,16 @@ class DRAM : public sc_module, public simple_mem_if {
 			}
 		}
 		
+		//Hand out the backing store for direct memory access, the caller charges the latency
+		unsigned int *DirectPointer(unsigned int addr, unsigned int &len){
+			if(addr >= DRAM_BASE_ADDR && addr < DRAM_BASE_ADDR + DRAM_SIZE){
+				len = DRAM_BASE_ADDR + DRAM_SIZE - addr;
+				return &main_memory[addr - DRAM_BASE_ADDR];
+			}
+			len = 0;
+			return NULL;
+		}
+		
 };
 
 
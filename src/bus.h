@@ -21,40 +21,216 @@ POWER MODELLING:
 	
 	Each transfer will be modelled as a 32-bit transfer of 1pJ
 	and a running tally is kept of the number of transfers. 
+
+ARBITRATION:
+	Who gets the bus is decided by a bus_arb_policy (see
+	bus_arbiter.h): round-robin by default, or fixed-priority,
+	weighted round-robin or TDMA using the per-master QoS
+	registers. The arbiter is event driven. While no request is queued it
+	sleeps on request_event instead of scanning the queues on
+	every clock edge, and it only follows the clock while a
+	request is being granted or released. A queued request is
+	granted arb_latency rising edges after it was posted (one
+	edge by default, the same as the original polled arbiter),
+	so cycle counts match the polled protocol.
+
+REQUEST QUEUES:
+	Each master owns a fixed ring of max_outstanding request
+	slots, allocated when the master is attached. A request
+	keeps its slot until the bus releases it, so no memory is
+	allocated while the simulation runs. A master that posts a
+	request while its ring is full stalls in Request() until
+	the bus frees one of its slots.
+
+DATA WIDTH AND BURSTS:
+	The data path is data_width bits wide (32, 64, 128 or 256)
+	and a beat carries data_width / 32 packed words. Bursts are
+	pipelined: the handshake that starts a chunk costs the same
+	cycles as a single-word transfer, every following beat one
+	cycle. The sender stages a chunk once the receiver is ready
+	and the receiver collects chunks until it has the words it
+	asked for, so both sides may use different chunk sizes (the
+	Cross_Bus forwards DRAM words one at a time into a long CC
+	burst). The single-word calls are one-word bursts.
+
+SPLIT TRANSACTIONS:
+	RequestRead() posts a tagged read (OP_READ_SPLIT) and
+	returns without waiting for the data, so a master can keep
+	several reads outstanding. The minion accepts the address
+	with AcceptRead(), which frees the bus right away, and
+	returns the data later with SendResponse() over a separate
+	read-data channel, one response at a time. The master
+	collects it with ReadResponse(). Tags index a fixed table
+	of max_outstanding transactions per master. Busy time of
+	the address/data path and of the response channel is kept
+	so utilization can be compared with blocking reads.
+
+ADDRESS MAP:
+	Minions register their address range with attach_minion()
+	during elaboration and get a minion ID back; overlapping
+	ranges are an elaboration error. The bus decodes each
+	request once when it grants it and only wakes the minion
+	that owns the address, so a minion sleeps in Listen()
+	through requests for other minions. A request for an
+	unmapped address, or a burst that runs past the end of
+	its minion's range, is reported and dropped: a blocking
+	request's WaitForAcknowledge() returns false, a split
+	read's ReadResponse() does.
+
+TRACING:
+	With set_trace() every transaction is recorded in a binary
+	bus_trace_writer when the bus releases it: master, address,
+	op, length, request/grant/release times and the cycles the
+	request waited for its grant. A split read is recorded when
+	the last word of its response has been sent, so its latency
+	covers the response phase. A bus built with debug set logs
+	every handshake at trace level (sim_log.h), compiled in
+	with SIM_LOG_LEVEL 4, for stepping through them.
 *************************************************************/
 
 #include <systemc.h>
 #include <queue>
+#include <sstream>
 #include <project_include.h>
+#include "bus_arbiter.h"
+#include "bus_trace.h"
+#include "sim_log.h"
 
 struct bus_request {
     unsigned int mst_id;
     unsigned int addr;
     unsigned int op;
     unsigned int len;
+    unsigned int tag;
+    sc_time request_time; // when the master called Request()
 
-    bus_request(unsigned int mst_id, unsigned int addr, unsigned int op, unsigned int len)
+    bus_request()
+        : mst_id(0)
+        , addr(0)
+        , op(0)
+        , len(0)
+        , tag(0) { }
+
+    bus_request(unsigned int mst_id, unsigned int addr, unsigned int op, unsigned int len, unsigned int tag = 0)
         : mst_id(mst_id)
         , addr(addr)
         , op(op)
-        , len(len) { }
+        , len(len)
+        , tag(tag) { }
+};
+
+// An outstanding split read, from RequestRead() until its data has been collected
+struct split_txn {
+    bool valid;
+    bool dropped; // no minion at the address, ReadResponse() fails
+    unsigned int mst_id;
+    unsigned int len;
+    unsigned int received;
+    std::vector<unsigned int> data;
+    unsigned int addr;    // for the trace record written when the response is complete
+    sc_time request_time;
+    sc_time grant_time;
+
+    split_txn()
+        : valid(false)
+        , dropped(false)
+        , mst_id(0)
+        , len(0)
+        , received(0)
+        , addr(0) { }
+};
+
+// Address range owned by one minion
+struct bus_minion_range {
+    unsigned int base;
+    unsigned int size;
+    unsigned int id;
+};
+
+// Fixed-capacity FIFO of request slots for one master
+class bus_request_ring {
+private:
+    std::vector<bus_request> slots;
+    unsigned int head;
+    unsigned int count;
+
+public:
+    bus_request_ring(unsigned int capacity)
+        : slots(capacity > 0 ? capacity : 1)
+        , head(0)
+        , count(0) { }
+
+    bool empty() const { return count == 0; }
+    bool full() const { return count == slots.size(); }
+    unsigned int size() const { return count; }
+    unsigned int capacity() const { return (unsigned int) slots.size(); }
+
+    bus_request *front() { return &slots[head]; }
+
+    bus_request *push(const bus_request &req) {
+        bus_request *slot = &slots[(head + count) % slots.size()];
+        *slot = req;
+        count++;
+        return slot;
+    }
+
+    void pop() {
+        head = (head + 1) % slots.size();
+        count--;
+    }
 };
 
 enum bus_state {
     IDLE,
     ACK_WAIT,
-    SERVING_RQ
+    SERVING_RQ,
+    SLEEPING,
+    ARBITRATING,
+    RELEASING
 };
 
 class bus_clocked : public sc_module, public bus_master_if, public bus_minion_if {
 private:
-    std::vector<std::deque<bus_request *>> request_queue;
+    std::vector<bus_request_ring> request_queue;
+    unsigned int max_outstanding;
     bus_request *cur_request;
-    int rrcount;
+
+    bus_arb_policy *policy;
+    std::vector<bus_master_qos> qos;
+    std::vector<bool> pending;
 
     bus_state state;
 
-    unsigned int bus_data;
+    // address decoder: ranges registered at elaboration, minion of the granted request
+    std::vector<bus_minion_range> address_map;
+    std::vector<sc_event *> minion_event;
+    int cur_minion;
+    std::vector<bool> rejected;
+
+    // arbiter wake-ups, the arbiter only follows the clock while it has work to do
+    sc_event request_event;
+    sc_event ack_event;
+    sc_event release_event;
+    sc_event slot_free_event;
+
+    // split transactions: tag table and the read-data channel
+    std::vector<split_txn> split_table;
+    sc_event txn_free_event;
+    sc_event response_event;
+    bool response_busy;
+    sc_time grant_time;
+
+    unsigned int arb_latency;
+    unsigned int arb_countdown;
+    sc_time idle_since;
+    sc_time clk_period;
+
+    // words packed into one beat of the data path
+    unsigned int words_per_beat;
+
+    // staging buffer for the data phase, holds the chunk being transferred
+    std::vector<unsigned int> bus_data;
+    unsigned int bus_data_pos;
 
     bool acknowledged;
     
@@ -62,109 +238,324 @@ private:
 
     int dbg;
 
+    bus_trace_writer *trace;
+    unsigned int trace_bus_id;
+    unsigned int grant_len;
+
 public:
     sc_in_clk clk;
     
 	unsigned int tally_bus_transfers;
+	unsigned int tally_bus_beats;
+
+    // time the address/data path and the split response channel were occupied
+    sc_time busy_time;
+    sc_time response_busy_time;
 
     SC_HAS_PROCESS(bus_clocked);
 
-    bus_clocked(sc_module_name name, int debug = 0) : sc_module(name) {
+    bus_clocked(sc_module_name name, int debug = 0, unsigned int arbitration_latency = 1,
+                unsigned int outstanding = BUS_MAX_OUTSTANDING,
+                unsigned int data_width = BUS_DATA_WIDTH) : sc_module(name) {
         tally_bus_transfers = 0;
+        tally_bus_beats = 0;
 		cur_request = NULL;
+        cur_minion = -1;
+        policy = new bus_rr_policy();
         state = IDLE;
         acknowledged = false;
         bus_ready = false;
         data_ready = false;
         dbg = debug;
-        
+        trace = NULL;
+        trace_bus_id = 0;
+        grant_len = 0;
+
+        // a request posted during cycle n can be granted on edge n + 1 at the earliest
+        arb_latency = arbitration_latency > 0 ? arbitration_latency : 1;
+        arb_countdown = 0;
+
+        max_outstanding = outstanding > 0 ? outstanding : 1;
+
+        if (data_width != 32 && data_width != 64 && data_width != 128 && data_width != 256) {
+            LOG_ERROR(LOG_BUS, "UNSUPPORTED BUS WIDTH " << data_width << ", USING 32 BITS");
+            data_width = 32;
+        }
+        words_per_beat = data_width / 32;
+        bus_data_pos = 0;
+
+        response_busy = false;
+
+        // no static sensitivity, bus_proc picks its next trigger itself
         SC_METHOD(bus_proc);
-        sensitive << clk.pos();
+    }
+
+    ~bus_clocked() {
+        delete policy;
+        for (unsigned int i = 0; i < minion_event.size(); i++) {
+            delete minion_event[i];
+        }
+    }
+
+    void end_of_elaboration() {
+        sc_clock *clock = dynamic_cast<sc_clock *>(clk.get_interface());
+        if (clock != NULL) {
+            clk_period = clock->period();
+        }
     }
 
     void attach_master(unsigned int &id) {
         id = (unsigned int) request_queue.size();
-        request_queue.push_back(std::deque<bus_request *>());
+        request_queue.push_back(bus_request_ring(max_outstanding));
+        split_table.resize(request_queue.size() * max_outstanding);
+        qos.push_back(bus_master_qos());
+        pending.push_back(false);
+        rejected.push_back(false);
+    }
+
+    // register a minion for [base, base + size), its ID is what it passes to Listen()
+    void attach_minion(unsigned int &id, unsigned int base, unsigned int size) {
+        for (unsigned int i = 0; i < address_map.size(); i++) {
+            const bus_minion_range &r = address_map[i];
+            if (base < r.base + r.size && r.base < base + size) {
+                std::ostringstream msg;
+                msg << "minion range " << base << "+" << size << " overlaps minion " << r.id
+                    << " at " << r.base << "+" << r.size;
+                SC_REPORT_ERROR(name(), msg.str().c_str());
+                return;
+            }
+        }
+        bus_minion_range r;
+        r.base = base;
+        r.size = size;
+        r.id = (unsigned int) minion_event.size();
+        address_map.push_back(r);
+        minion_event.push_back(new sc_event());
+        id = r.id;
+    }
+
+    // minion owning all of [addr, addr + len), -1 if the burst is not inside one minion's range
+    int decode(unsigned int addr, unsigned int len) const {
+        for (unsigned int i = 0; i < address_map.size(); i++) {
+            const bus_minion_range &r = address_map[i];
+            if (addr >= r.base && addr - r.base < r.size && len <= r.size - (addr - r.base)) {
+                return (int) address_map[i].id;
+            }
+        }
+        return -1;
+    }
+
+    // install an arbitration policy, the bus takes ownership of it
+    void set_arbitration(bus_arb_policy *arb) {
+        if (arb == NULL) {
+            return;
+        }
+        delete policy;
+        policy = arb;
+    }
+
+    const char *arbitration_name() const {
+        return policy->name();
+    }
+
+    // record every transaction in w, tagged with bus_id; the writer stays owned by the caller
+    void set_trace(bus_trace_writer *w, unsigned int bus_id = 0) {
+        trace = w;
+        trace_bus_id = bus_id;
     }
 
+    // QoS registers of an attached master
+    void set_master_qos(unsigned int mst_id, unsigned int priority, unsigned int weight) {
+        qos.at(mst_id).priority = priority;
+        qos.at(mst_id).weight = weight;
+    }
+
+    /*
+    Arbiter state machine. The IDLE and RELEASING states are evaluated on a
+    rising edge, SLEEPING and SERVING_RQ are woken by request_event and
+    release_event part way through a cycle and resynchronize to the next edge.
+    */
     void bus_proc() {
         switch(state) {
         case IDLE:
-            for (int i = 0; i < request_queue.size(); i++) {
-                std::deque<bus_request *> &tmp = request_queue.at((rrcount + i) % request_queue.size());
-                if (!tmp.empty()) {
-                    cur_request = tmp.front();
-                    tmp.pop_front();
-                    state = SERVING_RQ;
-                    break;
-                }
+            grant_or_sleep();
+            break;
+        case SLEEPING:
+            // a request was posted this cycle, grant it arb_latency edges from now
+            state = ARBITRATING;
+            arb_countdown = arb_latency;
+            next_trigger(clk.posedge_event());
+            break;
+        case ARBITRATING:
+            if (--arb_countdown > 0) {
+                next_trigger(clk.posedge_event());
+                break;
             }
-            rrcount++;
+            // the polled arbiter ran on every idle edge it slept through
+            if (clk_period != SC_ZERO_TIME) {
+                policy->idle((unsigned int) ((sc_time_stamp() - idle_since) / clk_period) - 1);
+            }
+            grant_or_sleep();
             break;
         case SERVING_RQ:
-            // cout << cur_request->len << endl;
-            if (cur_request->len <= 0) {
-                state = IDLE;
-                acknowledged = false;
-                cur_request = NULL;
+            // the last word moved this cycle, free the bus on the next edge
+            state = RELEASING;
+            next_trigger(clk.posedge_event());
+            break;
+        case RELEASING:
+            state = IDLE;
+            acknowledged = false;
+            busy_time += sc_time_stamp() - grant_time;
+            if (trace != NULL && cur_request->op != OP_READ_SPLIT) {
+                trace_release();
             }
+            // the granted request is always at the front of its master's ring
+            request_queue.at(cur_request->mst_id).pop();
+            slot_free_event.notify();
+            cur_request = NULL;
+            cur_minion = -1;
+            next_trigger(clk.posedge_event());
+            break;
+        default:
             break;
         }
     }
 
+    void grant_or_sleep() {
+        state = IDLE;
+        for (unsigned int i = 0; i < request_queue.size(); i++) {
+            pending[i] = !request_queue[i].empty();
+        }
+        unsigned long long cycle = 0;
+        if (clk_period != SC_ZERO_TIME) {
+            cycle = (unsigned long long) (sc_time_stamp() / clk_period);
+        }
+        int sel = policy->select(pending, qos, cycle);
+        if (sel >= 0) {
+            cur_request = request_queue.at(sel).front();
+            state = SERVING_RQ;
+        }
+
+        if (state == SERVING_RQ) {
+            grant_time = sc_time_stamp();
+            grant_len = cur_request->len;
+            cur_minion = decode(cur_request->addr, cur_request->len);
+            if (cur_request->op == OP_READ_SPLIT) {
+                split_txn &txn = split_table.at(cur_request->tag);
+                txn.addr = cur_request->addr;
+                txn.request_time = cur_request->request_time;
+                txn.grant_time = grant_time;
+            }
+            minion_event.at(cur_minion)->notify();
+            if (cur_request->len > 0) {
+                next_trigger(release_event);
+            } else {
+                state = RELEASING;
+                next_trigger(clk.posedge_event());
+            }
+        } else {
+            state = SLEEPING;
+            idle_since = sc_time_stamp();
+            next_trigger(request_event);
+        }
+    }
+
     void Request(unsigned int mst_id, unsigned int addr, unsigned int op, unsigned int len) {
-        if (dbg) cout << "Request " << addr << " - " << sc_time_stamp() << endl;
-        wait(clk.posedge_event());
-        wait(clk.posedge_event());
-        bus_request *req = new bus_request(mst_id, addr, op, len);
-        request_queue.at(mst_id).push_back(req);
-		
-		//Update tally:
-		tally_bus_transfers += len;
+        post_request(mst_id, addr, op, len, 0);
     }
 
     bool WaitForAcknowledge(unsigned int mst_id) {
+        if (rejected.at(mst_id)) {
+            rejected.at(mst_id) = false;
+            return false;
+        }
         while (!acknowledged || cur_request == NULL || cur_request->mst_id != mst_id) {
+            wait(ack_event);
             wait(clk.negedge_event());
         }
         return true;
     }
 
+    unsigned int data_width() const {
+        return words_per_beat * 32;
+    }
+
+    // size of the split read tag space, tags run from 0 to tag_count() - 1
+    unsigned int tag_count() const {
+        return (unsigned int) split_table.size();
+    }
+
+    // beats needed to move len words over the data path
+    unsigned int burst_beats(unsigned int len) const {
+        return (len + words_per_beat - 1) / words_per_beat;
+    }
+
     void ReadData(unsigned int &data) {
-        bus_ready = true;
-        while (!data_ready) {
-            wait(clk.posedge_event());
+        ReadBurst(&data, 1);
+    }
+
+    void WriteData(unsigned int data) {
+        WriteBurst(&data, 1);
+    }
+
+    void ReadBurst(unsigned int *data, unsigned int len) {
+        receive_burst(data, len, 2);
+    }
+
+    void WriteBurst(const unsigned int *data, unsigned int len) {
+        send_burst(data, len, 1);
+    }
+
+    unsigned int RequestRead(unsigned int mst_id, unsigned int addr, unsigned int len) {
+        // claim a free tag of this master, stall while all of them are in flight
+        unsigned int tag = 0;
+        bool found = false;
+        while (!found) {
+            for (unsigned int i = 0; i < max_outstanding && !found; i++) {
+                tag = mst_id * max_outstanding + i;
+                found = !split_table.at(tag).valid;
+            }
+            if (!found) {
+                wait(txn_free_event);
+            }
         }
 
-        if (dbg) cout << "ReadData - " << sc_time_stamp() << endl;
-        data = bus_data;
-        data_ready = false;
-        
-        cur_request->len--;
-        
-        wait(clk.posedge_event());
-        wait(clk.posedge_event());
+        split_txn &txn = split_table.at(tag);
+        txn.valid = true;
+        txn.dropped = false;
+        txn.mst_id = mst_id;
+        txn.len = len;
+        txn.received = 0;
+        txn.data.resize(len);
+
+        post_request(mst_id, addr, OP_READ_SPLIT, len, tag);
+        return tag;
     }
 
-    void WriteData(unsigned int data) {
-        while (!bus_ready) {
-            wait(clk.posedge_event());
+    bool ReadResponse(unsigned int tag, unsigned int *data, unsigned int len) {
+        split_txn &txn = split_table.at(tag);
+        if (!txn.valid) {
+            return false;
+        }
+        while (txn.received < txn.len && !txn.dropped) {
+            wait(response_event);
         }
 
-        if (dbg) cout << "WriteData - " << sc_time_stamp() << endl;
-        bus_data = data;
-        data_ready = true;
-        bus_ready = false;
-        wait(clk.posedge_event());
+        if (dbg) LOG_TRACE(LOG_BUS, "ReadResponse " << tag);
+        bool ok = !txn.dropped;
+        if (ok) {
+            std::copy(txn.data.begin(), txn.data.begin() + std::min(len, txn.len), data);
+        }
+        txn.valid = false;
+        txn_free_event.notify();
+        return ok;
     }
 
-    void Listen(unsigned int &req_addr, unsigned int &req_op, unsigned int &req_len) {
+    void Listen(unsigned int minion_id, unsigned int &req_addr, unsigned int &req_op, unsigned int &req_len) {
         wait(clk.posedge_event());
-        if (cur_request == NULL) {
-            req_addr = -1;
-            req_op = -1;
-            req_len = -1;
-            return;
+        // sleep until the bus grants a request decoded to this minion
+        while (cur_request == NULL || cur_minion != (int) minion_id) {
+            wait(*minion_event.at(minion_id));
         }
         req_addr = cur_request->addr;
         req_op = cur_request->op;
@@ -172,37 +563,165 @@ public:
     }
 
     void Acknowledge() {
-        if (dbg) cout << "Acknowledge - " << sc_time_stamp() << endl;
+        if (dbg) LOG_TRACE(LOG_BUS, "Acknowledge");
         wait(clk.posedge_event());
         acknowledged = true;
+        ack_event.notify();
     }
 
     void SendReadData(unsigned int data) {
-        while (!bus_ready) {
+        SendReadBurst(&data, 1);
+    }
+
+    void ReceiveWriteData(unsigned int &data) {
+        ReceiveWriteBurst(&data, 1);
+    }
+
+    void SendReadBurst(const unsigned int *data, unsigned int len) {
+        send_burst(data, len, 2);
+    }
+
+    void ReceiveWriteBurst(unsigned int *data, unsigned int len) {
+        receive_burst(data, len, 1);
+    }
+
+    unsigned int AcceptRead() {
+        if (dbg) LOG_TRACE(LOG_BUS, "AcceptRead");
+        wait(clk.posedge_event());
+        unsigned int tag = cur_request->tag;
+        acknowledged = true;
+        ack_event.notify();
+
+        // the address phase is all a split read needs, the data comes back on the response channel
+        cur_request->len = 0;
+        release_event.notify();
+        return tag;
+    }
+
+    void SendResponse(unsigned int tag, const unsigned int *data, unsigned int len) {
+        while (response_busy) {
             wait(clk.posedge_event());
         }
+        response_busy = true;
+        sc_time start = sc_time_stamp();
 
-        if (dbg) cout << "SendReadData - " << sc_time_stamp() << endl;
-        bus_data = data;
-        data_ready = true;
-        bus_ready = false;
-        
+        if (dbg) LOG_TRACE(LOG_BUS, "SendResponse " << tag << " " << len << " words");
+        split_txn &txn = split_table.at(tag);
+        unsigned int n = std::min(len, txn.len - txn.received);
+        std::copy(data, data + n, txn.data.begin() + txn.received);
+        tally_bus_beats += burst_beats(n);
+
+        // same pipelined beat timing as a read burst
+        wait_cycles(2 + burst_beats(n) - 1);
+
+        txn.received += n;
+        response_busy = false;
+        response_busy_time += sc_time_stamp() - start;
+        if (trace != NULL && txn.received == txn.len) {
+            trace->record(bus_trace_make(txn.mst_id, OP_READ_SPLIT, trace_bus_id, txn.addr, txn.len,
+                                         txn.request_time, txn.grant_time, sc_time_stamp(), clk_period));
+        }
+        response_event.notify();
+    }
+
+private:
+    // address phase shared by blocking and split requests
+    void post_request(unsigned int mst_id, unsigned int addr, unsigned int op, unsigned int len, unsigned int tag) {
+        if (dbg) LOG_TRACE(LOG_BUS, "Request " << addr);
+        sc_time requested = sc_time_stamp();
         wait(clk.posedge_event());
         wait(clk.posedge_event());
+        if (decode(addr, len) < 0) {
+            LOG_ERROR(LOG_BUS, "NO BUS MINION AT ADDRESS " << addr << " LENGTH " << len << ", REQUEST FROM MASTER " << mst_id << " DROPPED");
+            // a split read fails through its tag, a blocking request at its WaitForAcknowledge()
+            if (op == OP_READ_SPLIT) {
+                split_table.at(tag).dropped = true;
+                response_event.notify();
+            } else {
+                rejected.at(mst_id) = true;
+            }
+            return;
+        }
+        // back-pressure: hold the master until one of its slots is released
+        while (request_queue.at(mst_id).full()) {
+            if (dbg) LOG_TRACE(LOG_BUS, "Request stalled, master " << mst_id << " has " << max_outstanding << " outstanding");
+            wait(slot_free_event);
+        }
+        bus_request *slot = request_queue.at(mst_id).push(bus_request(mst_id, addr, op, len, tag));
+        slot->request_time = requested;
+        request_event.notify();
+		
+		//Update tally:
+		tally_bus_transfers += len;
     }
 
-    void ReceiveWriteData(unsigned int &data) {
-        bus_ready = true;
-        while (!data_ready) {
+    void trace_release() {
+        trace->record(bus_trace_make(cur_request->mst_id, cur_request->op, trace_bus_id, cur_request->addr, grant_len,
+                                     cur_request->request_time, grant_time, sc_time_stamp(), clk_period));
+    }
+
+    void wait_cycles(unsigned int cycles) {
+        for (unsigned int i = 0; i < cycles; i++) {
             wait(clk.posedge_event());
         }
-        if (dbg) cout << "ReceiveWriteData - " << sc_time_stamp() << endl;
-        data = bus_data;
-        data_ready = false;
-        
-        cur_request->len--;
-            // cout << cur_request->len << endl;
-        
-        wait(clk.posedge_event());
     }
-};
\ No newline at end of file
+
+    // sending side of the data phase: stage one chunk once the receiver is ready for it
+    void send_burst(const unsigned int *data, unsigned int len, unsigned int handshake_cycles) {
+        while (!bus_ready) {
+            wait(clk.posedge_event());
+        }
+
+        if (dbg) LOG_TRACE(LOG_BUS, "Send " << len << " words");
+        bus_data.assign(data, data + len);
+        bus_data_pos = 0;
+        data_ready = true;
+        bus_ready = false;
+        tally_bus_beats += burst_beats(len);
+
+        // first beat completes like a single-word transfer, the rest stream one per cycle
+        wait_cycles(handshake_cycles + burst_beats(len) - 1);
+
+        // a receiver taking the burst in chunks holds the sender until it has the last word,
+        // otherwise the sender's next request would find this data still staged
+        while (data_ready) {
+            wait(clk.posedge_event());
+        }
+    }
+
+    // receiving side of the data phase: collect staged chunks until len words have arrived
+    void receive_burst(unsigned int *data, unsigned int len, unsigned int handshake_cycles) {
+        unsigned int received = 0;
+        while (received < len) {
+            unsigned int cycles = 0;
+            if (!data_ready) {
+                bus_ready = true;
+                while (!data_ready) {
+                    wait(clk.posedge_event());
+                }
+                cycles = handshake_cycles - 1;
+            }
+
+            unsigned int n = std::min(len - received, (unsigned int) bus_data.size() - bus_data_pos);
+            if (dbg) LOG_TRACE(LOG_BUS, "Receive " << n << " words");
+            std::copy(bus_data.begin() + bus_data_pos, bus_data.begin() + bus_data_pos + n, data + received);
+            bus_data_pos += n;
+            received += n;
+            if (bus_data_pos == bus_data.size()) {
+                data_ready = false;
+            }
+
+            consume(n);
+
+            wait_cycles(cycles + burst_beats(n));
+        }
+    }
+
+    // account for words moved in the data phase, the last one releases the bus
+    void consume(unsigned int len) {
+        cur_request->len -= std::min(len, cur_request->len);
+        if (cur_request->len == 0) {
+            release_event.notify();
+        }
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+/*************************************************************
+Bus_Arbiter.h holds the arbitration policies of the on-chip
+bus. bus_clocked asks its policy which master to grant each
+time it arbitrates, passing the masters that have a request
+queued, their QoS registers and the current bus cycle.
+
+POLICIES:
+	rr   - round-robin, the original arbiter. The pointer moves
+	       on every arbitration slot, idle ones included.
+	fp   - fixed priority, the highest priority register wins
+	       and equal priorities are served in turn.
+	wrr  - weighted round-robin, a master keeps the bus for up
+	       to weight consecutive grants while it has requests.
+	tdma - time slots of slot_cycles bus cycles, each master
+	       owns weight slots of the frame. Slots whose owner
+	       has nothing queued are handed out round-robin.
+*************************************************************/
+
+#include <systemc.h>
+#include <string>
+#include <vector>
+
+//Per-master QoS registers
+struct bus_master_qos {
+    unsigned int priority; //higher wins under fp
+    unsigned int weight;   //grants per turn under wrr, slots per frame under tdma
+
+    bus_master_qos()
+        : priority(0)
+        , weight(1) { }
+};
+
+class bus_arb_policy {
+public:
+    virtual ~bus_arb_policy() { }
+
+    virtual const char *name() const = 0;
+
+    // master to grant among the pending ones, -1 if nothing is pending
+    virtual int select(const std::vector<bool> &pending, const std::vector<bus_master_qos> &qos, unsigned long long cycle) = 0;
+
+    // the bus slept through this many arbitration slots without calling select
+    virtual void idle(unsigned int /*slots*/) { }
+};
+
+class bus_rr_policy : public bus_arb_policy {
+private:
+    unsigned int rrcount;
+
+public:
+    bus_rr_policy()
+        : rrcount(0) { }
+
+    const char *name() const { return "round-robin"; }
+
+    int select(const std::vector<bool> &pending, const std::vector<bus_master_qos> &/*qos*/, unsigned long long /*cycle*/) {
+        int sel = -1;
+        for (unsigned int i = 0; i < pending.size(); i++) {
+            unsigned int m = (rrcount + i) % pending.size();
+            if (pending[m]) {
+                sel = (int) m;
+                break;
+            }
+        }
+        rrcount++;
+        return sel;
+    }
+
+    void idle(unsigned int slots) {
+        rrcount += slots;
+    }
+};
+
+class bus_fp_policy : public bus_arb_policy {
+private:
+    unsigned int last_grant;
+
+public:
+    bus_fp_policy()
+        : last_grant(0) { }
+
+    const char *name() const { return "fixed-priority"; }
+
+    int select(const std::vector<bool> &pending, const std::vector<bus_master_qos> &qos, unsigned long long /*cycle*/) {
+        int sel = -1;
+        // scan from the master after the last grant so equal priorities take turns
+        for (unsigned int i = 1; i <= pending.size(); i++) {
+            unsigned int m = (last_grant + i) % pending.size();
+            if (pending[m] && (sel < 0 || qos[m].priority > qos[sel].priority)) {
+                sel = (int) m;
+            }
+        }
+        if (sel >= 0) {
+            last_grant = (unsigned int) sel;
+        }
+        return sel;
+    }
+};
+
+class bus_wrr_policy : public bus_arb_policy {
+private:
+    unsigned int current;
+    unsigned int credits;
+
+public:
+    bus_wrr_policy()
+        : current(0)
+        , credits(0) { }
+
+    const char *name() const { return "weighted-round-robin"; }
+
+    int select(const std::vector<bool> &pending, const std::vector<bus_master_qos> &qos, unsigned long long /*cycle*/) {
+        if (current < pending.size() && pending[current] && credits > 0) {
+            credits--;
+            return (int) current;
+        }
+        for (unsigned int i = 1; i <= pending.size(); i++) {
+            unsigned int m = (current + i) % pending.size();
+            if (pending[m]) {
+                current = m;
+                credits = qos[m].weight > 0 ? qos[m].weight - 1 : 0;
+                return (int) m;
+            }
+        }
+        return -1;
+    }
+};
+
+class bus_tdma_policy : public bus_arb_policy {
+private:
+    unsigned int slot_cycles;
+    bus_rr_policy fallback;
+
+public:
+    bus_tdma_policy(unsigned int slot_len = 64)
+        : slot_cycles(slot_len > 0 ? slot_len : 1) { }
+
+    const char *name() const { return "tdma"; }
+
+    int select(const std::vector<bool> &pending, const std::vector<bus_master_qos> &qos, unsigned long long cycle) {
+        unsigned long long frame = 0;
+        for (unsigned int m = 0; m < qos.size(); m++) {
+            frame += qos[m].weight;
+        }
+
+        if (frame > 0) {
+            // find the owner of the current slot, master m owns weight consecutive slots
+            unsigned long long slot = (cycle / slot_cycles) % frame;
+            for (unsigned int m = 0; m < qos.size(); m++) {
+                if (slot < qos[m].weight) {
+                    if (pending[m]) {
+                        return (int) m;
+                    }
+                    break;
+                }
+                slot -= qos[m].weight;
+            }
+        }
+
+        // the slot owner is idle, reclaim the slot for someone else
+        return fallback.select(pending, qos, cycle);
+    }
+};
+
+//Build a policy from its command-line name, NULL if the name is unknown
+inline bus_arb_policy *make_arb_policy(const std::string &name) {
+    if (name == "rr") {
+        return new bus_rr_policy();
+    } else if (name == "fp") {
+        return new bus_fp_policy();
+    } else if (name == "wrr") {
+        return new bus_wrr_policy();
+    } else if (name == "tdma") {
+        return new bus_tdma_policy();
+    }
+    return NULL;
+}
@@ -0,0 +1,276 @@
+#pragma once
+
+/*************************************************************
+Bus_Crossbar.h is a multi-layer alternative to the single
+shared bus_clocked. Every slave (minion) gets its own layer,
+which is a complete bus_clocked with its own arbiter, and every
+master gets its own master port that routes each transaction
+to the layer of the addressed slave. Transfers to different
+slaves therefore run in parallel, e.g. the CPU polling the CC
+status registers while the CC streams weights from DRAM, and
+masters only compete when they address the same slave.
+
+ADDRESS MAP:
+	map_slave() gives a layer its address range at
+	elaboration. The range is checked against the other
+	layers (overlaps are an elaboration error) and registered
+	as the only minion of the layer. A request that does not
+	fit inside one range is reported and dropped, and fails
+	like one on bus_clocked.
+
+SPLIT TRANSACTIONS:
+	Tags returned by RequestRead() carry the layer in their
+	upper part (layer * tag_count + tag of the layer), so
+	ReadResponse() finds the layer again.
+
+UTILIZATION:
+	Each slave port reports the busy time of its layer and,
+	separately, of its split response channel. A master port
+	is counted busy from a Request() until its data phase has
+	finished, waiting for the grant included, and for the
+	address phase of split reads.
+
+POWER MODELLING:
+	Unchanged from bus_clocked: every word moved on any layer
+	is one 1 pJ transfer, summed in tally_bus_transfers().
+*************************************************************/
+
+#include <systemc.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <project_include.h>
+#include "bus.h"
+#include "bus_arbiter.h"
+
+class bus_crossbar : public sc_module {
+private:
+    // master side of the crossbar, routes one master's calls to the addressed layer
+    class master_port : public bus_master_if {
+    private:
+        bus_crossbar *xbar;
+        int cur_layer;
+        bool rejected;
+        sc_time start;
+
+    public:
+        sc_time busy_time;
+
+        master_port(bus_crossbar *owner)
+            : xbar(owner)
+            , cur_layer(-1)
+            , rejected(false) { }
+
+        void Request(unsigned int mst_id, unsigned int addr, unsigned int op, unsigned int len) {
+            start = sc_time_stamp();
+            cur_layer = xbar->decode(addr, len);
+            if (cur_layer < 0) {
+                LOG_ERROR(LOG_BUS, "NO CROSSBAR SLAVE AT ADDRESS " << addr << " LENGTH " << len << ", REQUEST FROM MASTER " << mst_id << " DROPPED");
+                rejected = true;
+                return;
+            }
+            xbar->layers[cur_layer]->Request(mst_id, addr, op, len);
+        }
+
+        bool WaitForAcknowledge(unsigned int mst_id) {
+            if (rejected) {
+                rejected = false;
+                return false;
+            }
+            return xbar->layers[cur_layer]->WaitForAcknowledge(mst_id);
+        }
+
+        void ReadData(unsigned int &data) {
+            ReadBurst(&data, 1);
+        }
+
+        void WriteData(unsigned int data) {
+            WriteBurst(&data, 1);
+        }
+
+        void ReadBurst(unsigned int *data, unsigned int len) {
+            xbar->layers[cur_layer]->ReadBurst(data, len);
+            busy_time += sc_time_stamp() - start;
+        }
+
+        void WriteBurst(const unsigned int *data, unsigned int len) {
+            xbar->layers[cur_layer]->WriteBurst(data, len);
+            busy_time += sc_time_stamp() - start;
+        }
+
+        unsigned int RequestRead(unsigned int mst_id, unsigned int addr, unsigned int len) {
+            sc_time begin = sc_time_stamp();
+            int layer = xbar->decode(addr, len);
+            if (layer < 0) {
+                LOG_ERROR(LOG_BUS, "NO CROSSBAR SLAVE AT ADDRESS " << addr << " LENGTH " << len << ", SPLIT READ FROM MASTER " << mst_id << " DROPPED");
+                return xbar->invalid_tag();
+            }
+            unsigned int tag = xbar->layers[layer]->RequestRead(mst_id, addr, len);
+            busy_time += sc_time_stamp() - begin;
+            return (unsigned int) layer * xbar->layers[layer]->tag_count() + tag;
+        }
+
+        bool ReadResponse(unsigned int tag, unsigned int *data, unsigned int len) {
+            if (tag == xbar->invalid_tag()) {
+                return false;
+            }
+            unsigned int per_layer = xbar->layers[0]->tag_count();
+            return xbar->layers[tag / per_layer]->ReadResponse(tag % per_layer, data, len);
+        }
+    };
+
+    struct slave_range {
+        unsigned int base;
+        unsigned int size;
+        bool mapped;
+    };
+    std::vector<slave_range> address_map;
+
+    std::vector<master_port *> masters;
+
+    // layer owning all of [addr, addr + len), -1 if the burst is not inside one range
+    int decode(unsigned int addr, unsigned int len) const {
+        for (unsigned int i = 0; i < address_map.size(); i++) {
+            const slave_range &r = address_map[i];
+            if (r.mapped && addr >= r.base && addr - r.base < r.size && len <= r.size - (addr - r.base)) {
+                return (int) i;
+            }
+        }
+        return -1;
+    }
+
+    unsigned int invalid_tag() const {
+        return (unsigned int) layers.size() * layers[0]->tag_count();
+    }
+
+public:
+    sc_in_clk clk;
+
+    // one bus per slave, the slave's minion port binds to slave(i)
+    std::vector<bus_clocked *> layers;
+
+    bus_crossbar(sc_module_name name, unsigned int num_masters, unsigned int num_slaves, int debug = 0,
+                 unsigned int outstanding = BUS_MAX_OUTSTANDING, unsigned int data_width = BUS_DATA_WIDTH)
+        : sc_module(name) {
+        for (unsigned int i = 0; i < num_slaves; i++) {
+            std::string layer_name("layer_" + std::to_string(i));
+            bus_clocked *layer = new bus_clocked(layer_name.c_str(), debug, 1, outstanding, data_width);
+            layer->clk(clk);
+            for (unsigned int m = 0; m < num_masters; m++) {
+                unsigned int idtmp;
+                layer->attach_master(idtmp);
+            }
+            layers.push_back(layer);
+
+            slave_range r;
+            r.base = 0;
+            r.size = 0;
+            r.mapped = false;
+            address_map.push_back(r);
+        }
+        for (unsigned int m = 0; m < num_masters; m++) {
+            masters.push_back(new master_port(this));
+        }
+    }
+
+    ~bus_crossbar() {
+        for (unsigned int m = 0; m < masters.size(); m++) {
+            delete masters[m];
+        }
+    }
+
+    // give slave port i the range [base, base + size), minion_id is for the slave's Listen()
+    void map_slave(unsigned int i, unsigned int &minion_id, unsigned int base, unsigned int size) {
+        for (unsigned int j = 0; j < address_map.size(); j++) {
+            const slave_range &r = address_map[j];
+            if (r.mapped && base < r.base + r.size && r.base < base + size) {
+                std::ostringstream msg;
+                msg << "slave range " << base << "+" << size << " overlaps slave " << j
+                    << " at " << r.base << "+" << r.size;
+                SC_REPORT_ERROR(name(), msg.str().c_str());
+                return;
+            }
+        }
+        address_map.at(i).base = base;
+        address_map.at(i).size = size;
+        address_map.at(i).mapped = true;
+        layers.at(i)->attach_minion(minion_id, base, size);
+    }
+
+    bus_master_if &master(unsigned int id) {
+        return *masters.at(id);
+    }
+
+    bus_minion_if &slave(unsigned int i) {
+        return *layers.at(i);
+    }
+
+    unsigned int num_masters() const {
+        return (unsigned int) masters.size();
+    }
+
+    unsigned int num_slaves() const {
+        return (unsigned int) layers.size();
+    }
+
+    // every slave gets its own arbiter running the named policy, false if the name is unknown
+    bool set_arbitration(const std::string &policy) {
+        for (unsigned int i = 0; i < layers.size(); i++) {
+            bus_arb_policy *arb = make_arb_policy(policy);
+            if (arb == NULL) {
+                return false;
+            }
+            layers[i]->set_arbitration(arb);
+        }
+        return true;
+    }
+
+    const char *arbitration_name() const {
+        return layers.at(0)->arbitration_name();
+    }
+
+    void set_master_qos(unsigned int mst_id, unsigned int priority, unsigned int weight) {
+        for (unsigned int i = 0; i < layers.size(); i++) {
+            layers[i]->set_master_qos(mst_id, priority, weight);
+        }
+    }
+
+    unsigned int data_width() const {
+        return layers.at(0)->data_width();
+    }
+
+    // trace all layers into w, the layer number goes into the records' bus_id
+    void set_trace(bus_trace_writer *w) {
+        for (unsigned int i = 0; i < layers.size(); i++) {
+            layers[i]->set_trace(w, i);
+        }
+    }
+
+    unsigned int tally_bus_transfers() const {
+        unsigned int total = 0;
+        for (unsigned int i = 0; i < layers.size(); i++) {
+            total += layers[i]->tally_bus_transfers;
+        }
+        return total;
+    }
+
+    unsigned int tally_bus_beats() const {
+        unsigned int total = 0;
+        for (unsigned int i = 0; i < layers.size(); i++) {
+            total += layers[i]->tally_bus_beats;
+        }
+        return total;
+    }
+
+    const sc_time &slave_busy_time(unsigned int i) const {
+        return layers.at(i)->busy_time;
+    }
+
+    const sc_time &slave_response_busy_time(unsigned int i) const {
+        return layers.at(i)->response_busy_time;
+    }
+
+    const sc_time &master_busy_time(unsigned int id) const {
+        return masters.at(id)->busy_time;
+    }
+};
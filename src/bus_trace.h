@@ -0,0 +1,198 @@
+#pragma once
+
+/*************************************************************
+Bus_Trace.h is a low-overhead binary trace of on-chip bus
+transactions. The buses (bus_clocked, tlm_bus) build their
+records with bus_trace_make() and hand every finished
+transaction to a bus_trace_writer, which copies it into a ring
+of fixed-size blocks in memory. A background thread writes
+full blocks to the file, so the simulation never waits on the
+disk. record() takes no lock: the simulation thread takes it
+once per full block to publish the block and wake the writer,
+and only sleeps on it while every block is still waiting to
+be written.
+
+FILE FORMAT:
+	A bus_trace_header followed by bus_trace_record entries,
+	all in host byte order. Times are in picoseconds. The
+	records of one bus are in completion order, traces of a
+	crossbar interleave the layers (see bus_id).
+	bus_trace_decode turns a trace into CSV and per-master
+	latency histograms.
+*************************************************************/
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define BUS_TRACE_MAGIC "EIEBTRC1"
+#define BUS_TRACE_VERSION 1
+
+struct bus_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t clk_period_ps; // on-chip clock, to turn times into cycles
+};
+
+struct bus_trace_record {
+    uint8_t master;
+    uint8_t op;            // OP_READ, OP_WRITE or OP_READ_SPLIT
+    uint16_t bus_id;       // crossbar layer, 0 on a single bus
+    uint32_t addr;
+    uint32_t len;          // words
+    uint32_t wait_cycles;  // bus cycles from request to grant
+    uint64_t request_ps;   // master called Request()
+    uint64_t grant_ps;     // arbiter granted the bus
+    uint64_t complete_ps;  // bus released, last response word sent for OP_READ_SPLIT
+};
+
+// simulation time in picoseconds, TIME is sc_time (kept generic so the decoder needs no SystemC)
+template <typename TIME>
+inline uint64_t bus_trace_ps(const TIME &t) {
+    return (uint64_t) (t.to_seconds() * 1e12 + 0.5);
+}
+
+// record of a transaction requested, granted and completed at the given times
+template <typename TIME>
+inline bus_trace_record bus_trace_make(unsigned int master, unsigned int op, unsigned int bus_id, unsigned int addr,
+                                       unsigned int len, const TIME &requested, const TIME &granted,
+                                       const TIME &completed, const TIME &clk_period) {
+    bus_trace_record rec;
+    rec.master = (uint8_t) master;
+    rec.op = (uint8_t) op;
+    rec.bus_id = (uint16_t) bus_id;
+    rec.addr = addr;
+    rec.len = len;
+    rec.wait_cycles = (clk_period > TIME()) ? (uint32_t) ((granted - requested) / clk_period) : 0;
+    rec.request_ps = bus_trace_ps(requested);
+    rec.grant_ps = bus_trace_ps(granted);
+    rec.complete_ps = bus_trace_ps(completed);
+    return rec;
+}
+
+class bus_trace_writer {
+private:
+    struct block {
+        std::vector<bus_trace_record> records;
+        unsigned int count;
+    };
+
+    FILE *file;
+    std::vector<block> ring;
+    unsigned int block_records;
+
+    // blocks handed to the writer thread and blocks it has written back, guarded by lock
+    unsigned long long published;
+    unsigned long long flushed;
+    bool closing;
+    std::mutex lock;
+    std::condition_variable block_published; // wakes the writer
+    std::condition_variable block_flushed;   // wakes a simulation waiting for a free block
+    std::thread writer;
+
+    unsigned long long filling; // block the simulation is appending to
+
+    void writer_loop() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            block_published.wait(guard, [this] { return flushed < published || closing; });
+            if (flushed == published) {
+                break;
+            }
+            // the block is the writer's until flushed moves past it, write it without the lock
+            block &b = ring[flushed % ring.size()];
+            guard.unlock();
+            fwrite(b.records.data(), sizeof(bus_trace_record), b.count, file);
+            guard.lock();
+            flushed++;
+            block_flushed.notify_one();
+        }
+        fflush(file);
+    }
+
+    void publish() {
+        std::unique_lock<std::mutex> guard(lock);
+        published = filling + 1;
+        block_published.notify_one();
+        filling++;
+        // back-pressure: only reuse a block once the writer has written it
+        block_flushed.wait(guard, [this] { return filling - flushed < ring.size(); });
+        ring[filling % ring.size()].count = 0;
+    }
+
+public:
+    unsigned long long records_written;
+
+    bus_trace_writer(const std::string &path, double clk_period_ns, unsigned int blocks = 8, unsigned int records_per_block = 16384)
+        : ring(blocks > 1 ? blocks : 2)
+        , block_records(records_per_block > 0 ? records_per_block : 1)
+        , published(0)
+        , flushed(0)
+        , closing(false)
+        , filling(0)
+        , records_written(0) {
+        for (unsigned int i = 0; i < ring.size(); i++) {
+            ring[i].records.resize(block_records);
+            ring[i].count = 0;
+        }
+
+        file = fopen(path.c_str(), "wb");
+        if (file == NULL) {
+            printf("ERROR: CANNOT OPEN BUS TRACE %s\n", path.c_str());
+            return;
+        }
+
+        bus_trace_header header;
+        memcpy(header.magic, BUS_TRACE_MAGIC, sizeof(header.magic));
+        header.version = BUS_TRACE_VERSION;
+        header.record_size = sizeof(bus_trace_record);
+        header.clk_period_ps = (uint64_t) (clk_period_ns * 1000.0 + 0.5);
+        fwrite(&header, sizeof(header), 1, file);
+
+        writer = std::thread(&bus_trace_writer::writer_loop, this);
+    }
+
+    ~bus_trace_writer() {
+        close();
+    }
+
+    bool is_open() const {
+        return file != NULL;
+    }
+
+    void record(const bus_trace_record &rec) {
+        if (file == NULL) {
+            return;
+        }
+        block &b = ring[filling % ring.size()];
+        b.records[b.count++] = rec;
+        records_written++;
+        if (b.count == block_records) {
+            publish();
+        }
+    }
+
+    // write out the partial block and stop the writer thread
+    void close() {
+        if (file == NULL) {
+            return;
+        }
+        if (ring[filling % ring.size()].count > 0) {
+            publish();
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closing = true;
+        }
+        block_published.notify_one();
+        writer.join();
+        fclose(file);
+        file = NULL;
+    }
+};
@@ -0,0 +1,164 @@
+/*************************************************************
+Bus_Trace_Decode.cpp is the offline reader for the binary bus
+traces written with Proj_exec -T. It prints, for every bus
+master, the number of transactions and words, the mean and
+worst wait for a grant and a log2 histogram of the latency
+from Request() to release, or to the end of the response of
+a split read, all in bus cycles. With -c it also
+writes every transaction as one CSV row.
+
+Usage: ./bus_trace_decode <trace> <-c file.csv>
+*************************************************************/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bus_trace.h"
+
+using namespace std;
+
+#define HIST_BUCKETS 32
+
+struct master_stats {
+	unsigned long long transactions;
+	unsigned long long words;
+	unsigned long long wait_total;
+	unsigned long long wait_max;
+	unsigned long long latency_total;
+	unsigned long long latency_max;
+	unsigned long long hist[HIST_BUCKETS]; //bucket b holds latencies in [2^(b-1), 2^b)
+
+	master_stats()
+		: transactions(0)
+		, words(0)
+		, wait_total(0)
+		, wait_max(0)
+		, latency_total(0)
+		, latency_max(0)
+		, hist() { }
+};
+
+//bucket of a latency in cycles: 0 for 0, then one bucket per power of two
+static unsigned int hist_bucket(unsigned long long cycles) {
+	unsigned int b = 0;
+	while (cycles > 0 && b < HIST_BUCKETS - 1) {
+		cycles >>= 1;
+		b++;
+	}
+	return b;
+}
+
+static const char *op_name(unsigned int op) {
+	switch (op) {
+	case 5: return "read";
+	case 6: return "write";
+	case 9: return "split_read";
+	default: return "other";
+	}
+}
+
+int main(int argc, char *argv[]) {
+	std::string trace_path, csv_path;
+	for (int i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+		if (arg == "-c" && i + 1 < argc) {
+			csv_path = argv[++i];
+		} else if (trace_path.empty() && arg[0] != '-') {
+			trace_path = arg;
+		} else {
+			trace_path.clear();
+			break;
+		}
+	}
+	if (trace_path.empty()) {
+		cout << "Usage: ./bus_trace_decode <trace> <-c file.csv>" << endl;
+		return 1;
+	}
+
+	FILE *in = fopen(trace_path.c_str(), "rb");
+	if (in == NULL) {
+		cout << "ERROR: CANNOT OPEN " << trace_path << endl;
+		return 1;
+	}
+
+	bus_trace_header header;
+	if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, BUS_TRACE_MAGIC, sizeof(header.magic)) != 0) {
+		cout << "ERROR: " << trace_path << " IS NOT A BUS TRACE" << endl;
+		fclose(in);
+		return 1;
+	}
+	if (header.version != BUS_TRACE_VERSION || header.record_size != sizeof(bus_trace_record)) {
+		cout << "ERROR: UNSUPPORTED TRACE VERSION " << header.version << " (RECORD SIZE " << header.record_size << ")" << endl;
+		fclose(in);
+		return 1;
+	}
+	double period = header.clk_period_ps > 0 ? (double) header.clk_period_ps : 1.0;
+
+	FILE *csv = NULL;
+	if (!csv_path.empty()) {
+		csv = fopen(csv_path.c_str(), "w");
+		if (csv == NULL) {
+			cout << "ERROR: CANNOT OPEN " << csv_path << endl;
+			fclose(in);
+			return 1;
+		}
+		fprintf(csv, "bus,master,op,addr,len,request_ps,grant_ps,complete_ps,wait_cycles,latency_cycles\n");
+	}
+
+	std::map<unsigned int, master_stats> masters;
+	std::vector<bus_trace_record> block(16384);
+	unsigned long long total = 0;
+	size_t n;
+	while ((n = fread(block.data(), sizeof(bus_trace_record), block.size(), in)) > 0) {
+		for (size_t i = 0; i < n; i++) {
+			const bus_trace_record &r = block[i];
+			unsigned long long latency = (unsigned long long) ((r.complete_ps - r.request_ps) / period + 0.5);
+
+			master_stats &m = masters[r.master];
+			m.transactions++;
+			m.words += r.len;
+			m.wait_total += r.wait_cycles;
+			m.wait_max = std::max(m.wait_max, (unsigned long long) r.wait_cycles);
+			m.latency_total += latency;
+			m.latency_max = std::max(m.latency_max, latency);
+			m.hist[hist_bucket(latency)]++;
+
+			if (csv != NULL) {
+				fprintf(csv, "%u,%u,%s,%u,%u,%llu,%llu,%llu,%u,%llu\n", (unsigned int) r.bus_id, (unsigned int) r.master,
+					op_name(r.op), r.addr, r.len, (unsigned long long) r.request_ps, (unsigned long long) r.grant_ps,
+					(unsigned long long) r.complete_ps, r.wait_cycles, latency);
+			}
+		}
+		total += n;
+	}
+	fclose(in);
+	if (csv != NULL) {
+		fclose(csv);
+	}
+
+	cout << "Bus trace " << trace_path << ": " << total << " transactions, clock period " << header.clk_period_ps << " ps" << endl;
+	for (std::map<unsigned int, master_stats>::iterator it = masters.begin(); it != masters.end(); ++it) {
+		const master_stats &m = it->second;
+		cout << "\n----------------------------------\n";
+		cout << "Master " << it->first << endl;
+		cout << "Transactions: " << m.transactions << ", words: " << m.words << endl;
+		cout << "Wait for grant (cycles): mean " << (double) m.wait_total / m.transactions << ", max " << m.wait_max << endl;
+		cout << "Latency (cycles): mean " << (double) m.latency_total / m.transactions << ", max " << m.latency_max << endl;
+		cout << "Latency histogram (cycles):" << endl;
+		for (unsigned int b = 0; b < HIST_BUCKETS; b++) {
+			if (m.hist[b] == 0) {
+				continue;
+			}
+			unsigned long long lo = b == 0 ? 0 : 1ULL << (b - 1);
+			unsigned long long hi = b == 0 ? 0 : (1ULL << b) - 1;
+			printf("  %10llu - %-10llu %llu\n", lo, hi, m.hist[b]);
+		}
+	}
+	cout << "\n----------------------------------\n";
+	return 0;
+}
@@ -1,7 +1,14 @@
 #include "systemc.h"
 #include "project_include.h"
+#include "dram_cache.h"
+#include "sim_log.h"
+#include <tlm.h>
+#include <tlm_utils/simple_target_socket.h>
 #include <stdio.h>
 #include <stdlib.h> 
+#include <algorithm>
+#include <deque>
+#include <vector>
 
 /*************************************************************
 Cross_Bus_Module.h is the interface between the internal and 
@@ -13,11 +20,115 @@ The implementation is all memory-mapped, so you don't have to
 worry about changing between internal and external addresses
 for I/O.
 
-Future considerations: 
-	Adding cache to this module would serve to model a real 
-	processor. Almost every processor these days comes with
-	cache of some kind and if we're modelling an SoC without
-	cache at some level it's kind of a disingenuous model. 
+CACHE:
+	enable_cache() puts a set-associative cache (dram_cache)
+	in front of the DRAM, off by default. A hit is served in
+	the internal clock cycle of the access. A miss writes back
+	a dirty victim and fills the line, each as one DRAM burst
+	of a whole line: the first word costs the usual DRAM
+	latency and every further word one external cycle. Write-
+	through writes and uncached accesses still go to the DRAM
+	one word at a time. The cache tracks tags only, the data
+	always comes from and goes to the DRAM backing store.
+	flush_cache() writes the lines still dirty at the end of
+	the run back as line bursts, so their time and energy are
+	charged like any other write-back.
+
+BURSTS:
+	Without the cache a bus burst is forwarded to the DRAM as
+	one burst (simple_mem_if::ReadBurst/WriteBurst) through an
+	asynchronous FIFO of CROSS_BUS_FIFO_DEPTH words between the
+	two clock domains. Each side moves half the FIFO at a time,
+	so the external side fetches the next half while the
+	internal side sends the previous one on the bus, and the
+	two threads synchronise once per half FIFO instead of once
+	per word. A word crossing the FIFO is picked up on the next
+	edge of the receiving clock. Without the write buffer
+	writes are not posted: the Cross_Bus takes no new request
+	until the DRAM has written the last word.
+
+WRITE BUFFER:
+	With write_buffer_depth set, writes on the burst path are
+	posted. The internal side takes the words off the bus half
+	a FIFO at a time into a buffer of up to write_buffer_depth
+	words and takes the next request straight away, so a
+	write costs only its bus cycles until the buffer is full.
+	The external thread drains the buffer in order whenever no
+	request is waiting, one DRAM burst per run of consecutive
+	addresses (at most half a FIFO), so reads overtake posted
+	writes. A read of a word that is still in the buffer gets
+	the newest posted value (read-after-write forwarding), and
+	a drained write discards any prefetched words it overlaps.
+	Words posted at the end of the simulation are never
+	written. The cache path and the loosely-timed path do not
+	post writes. Only one drain burst is in flight at a time,
+	but the external thread does not wait for it, so requests
+	for other channels go ahead in parallel.
+
+CHANNELS:
+	dram_if is a multiport: every DRAM bound to it is one
+	channel and gets its own channel_thread, spawned at the end
+	of elaboration, that runs the bursts queued for it in
+	order. The address space is interleaved across the
+	channels in units of interleave_words (a line of the
+	configured cache, used or not, or a DRAM row): unit u of
+	the DRAM lives on channel u % channels. Every DRAM access
+	of the external thread is split at the unit boundaries and the pieces are queued on
+	their channels at once, so a half FIFO that spans several
+	channels is read or written in parallel and takes as long
+	as its slowest channel. With one channel nothing is split
+	and the timing is that of a single DRAM. Reads and writes
+	of the same word always meet on the same channel queue, in
+	the order they were issued. Peek, Poke and DMI use the
+	first channel, all channels share one backing store.
+	
+	The loosely-timed path charges each half FIFO the cycles
+	of its busiest channel.
+
+STREAM PREFETCHER:
+	With prefetch_depth set, the external side runs ahead of
+	sequential reads on the burst path. A read that starts
+	where the previous read ended starts a stream, and while
+	no request is waiting the external thread fetches the
+	words after it, half a FIFO per DRAM burst, into a buffer
+	of up to prefetch_depth words. A read that continues the
+	stream, or starts a few words further on inside the
+	buffer, takes its leading words from the buffer without
+	waiting on the DRAM. Reads elsewhere (the CPU fetching a
+	label) leave the stream alone, a second sequential pair
+	replaces it and discards its buffer, and writes discard
+	any prefetched words they overlap. A request that arrives
+	while a prefetch burst is running waits for it.
+	
+	Prefetched words are DRAM transfers whether they are used
+	or not. Accuracy is used/prefetched words and coverage is
+	used/read words on the burst path. The loosely-timed path
+	does not prefetch.
+
+SPLIT READS:
+	Split reads (OP_READ_SPLIT) are accepted into a queue, which
+	frees the internal bus, and served in order by
+	split_read_thread. The queue is not bounded here: every
+	queued read holds one of its master's tags until the master
+	collects the data, so a master with all its tags in flight
+	stalls in RequestRead() without holding the bus. Each half FIFO
+	is returned on the bus response channel as soon as it has
+	crossed the FIFO. The DRAM side is shared with blocking
+	requests through dram_lock.
+
+LOOSELY-TIMED MODEL:
+	When the system is built around tlm_bus the internal bus
+	port is left unbound and transactions arrive on
+	minion_socket instead. They are served straight from the
+	DRAM with Peek/Poke and the cycles of one DRAM burst are
+	added to the annotated delay, so the bus threads never run.
+	
+	get_direct_mem_ptr grants the whole DRAM for direct memory
+	access with the per-word DRAM latency. An initiator that
+	copied a burst through the pointer follows it with a
+	TLM_IGNORE_COMMAND transaction of the same address and
+	length, which is charged like a read (DRAM cycles and
+	transfer_tally) without moving any data.
 
 POWER MODELLING:
 	Power modelling is carried out with Yousef's power 
@@ -39,7 +150,7 @@ POWER MODELLING:
 *************************************************************/
 
 
-class Cross_Bus : public sc_module {
+class Cross_Bus : public sc_module, public dram_coherence_if {
 	
 	private:
 		bool in_use;
@@ -56,68 +167,403 @@ class Cross_Bus : public sc_module {
 		unsigned int wdata;
 
 		unsigned int dram_req_addr;
+		unsigned int dram_req_op;
+		unsigned int dram_req_len; //more than one word is a line burst
+		bool dram_req_stream;      //burst streamed through the FIFO
+		bool dram_busy;
+		unsigned int dram_data;
+		
+		//asynchronous FIFO between the clock domains, filled by the DRAM side for reads
+		//and by the bus side for writes
+		std::deque<unsigned int> fifo;
+		sc_event fifo_data_event;
+		sc_event fifo_space_event;
+		std::vector<unsigned int> bus_chunk;  //half FIFO on the internal side
+		std::vector<unsigned int> dram_chunk; //half FIFO on the external side
+		bool dram_req_pending;                //set with dram_access_event, the external thread may be prefetching
+		
+		//stream prefetcher, the buffer holds the words from prefetch_head on
+		std::deque<unsigned int> prefetch_buf;
+		unsigned int prefetch_head;
+		bool stream_valid;
+		unsigned int prefetch_fetch_addr, prefetch_fetching; //words prefetch() is waiting for, 0 when idle
+		bool prefetch_stale;                                 //drop them, the host rewrote DRAM meanwhile
+		unsigned int candidate_next; //end of the last read outside the stream
+		
+		//posted writes waiting for the DRAM, oldest first
+		struct posted_write {
+			unsigned int addr;
+			unsigned int data;
+		};
+		std::deque<posted_write> write_buf;
+		sc_event write_space_event;
+
+		//only one thread at a time drives the external bus
+		sc_mutex dram_lock;
+		
+		//a burst queued on one channel, data NULL only charges the time (cache line bursts)
+		struct channel_cmd {
+			unsigned int op;
+			unsigned int addr;
+			unsigned int len;
+			unsigned int *data;
+			unsigned int *pending; //pieces of the access still queued or running
+		};
+		std::vector<std::deque<channel_cmd> > channel_queue;
+		std::vector<sc_event *> channel_event;
+		sc_event channel_done_event;
+		std::vector<unsigned int> drain_data; //the write buffer drain in flight
+		unsigned int drain_pending;
+
+		//split reads accepted on the internal bus, waiting for the DRAM
+		struct split_read {
+			unsigned int tag;
+			unsigned int addr;
+			unsigned int len;
+		};
+		std::deque<split_read> split_queue; //bounded by the bus's tags, see SPLIT READS
+		sc_event split_queue_event;
 		
 	public:
 		//This is a bus minion, must connect to the minion port. 
-		sc_port<bus_minion_if> internal_bus;
-		sc_port<simple_mem_if> dram_if;
+		sc_port<bus_minion_if, 1, SC_ZERO_OR_MORE_BOUND> internal_bus;
+		sc_port<simple_mem_if, DRAM_MAX_CHANNELS> dram_if; //one DRAM per channel
+		unsigned int minion_id; //from bus_clocked::attach_minion
+		
+		//target socket on tlm_bus, used instead of internal_bus
+		tlm_utils::simple_target_socket_optional<Cross_Bus> minion_socket;
 		
 		sc_in_clk internal_clk;
 		sc_in_clk external_clk;
 		
 		unsigned int transfer_tally;
+		unsigned int burst_tally; //DRAM burst transactions: line fills, write-backs and streamed half FIFOs
+		
+		dram_cache * cache; //NULL unless enable_cache() was called
+		unsigned int flushed_lines; //dirty lines written back by flush_cache()
+		
+		unsigned int prefetch_depth; //words, 0 turns the stream prefetcher off
+		unsigned long long tally_prefetched;
+		unsigned long long tally_prefetch_used;
+		unsigned long long tally_prefetch_discarded;
+		unsigned long long tally_stream_read_words; //read words on the burst path
+		
+		unsigned int write_buffer_depth; //words, 0 turns posted writes off
+		unsigned long long tally_posted_writes;
+		unsigned long long tally_write_drains;     //DRAM bursts draining the buffer
+		unsigned long long tally_write_forwarded;  //read words served from the buffer
+		unsigned int write_buffer_peak;
+		sc_time write_buffer_stall;                //internal side waiting for space
+		
+		unsigned int interleave_words; //channel interleaving unit
+		std::vector<unsigned long long> tally_channel_words;
+		std::vector<sc_time> channel_busy;
 		
 		SC_HAS_PROCESS(Cross_Bus);
 		
 		//Constructor
-		Cross_Bus(sc_module_name name) : sc_module(name) {
-			cout << "CROSS BUS has been instantiated with name *" << name << endl;
+		Cross_Bus(sc_module_name name) : sc_module(name), minion_socket("minion_socket") {
+			LOG_INFO(LOG_XBUS, "CROSS BUS has been instantiated with name *" << name);
 			
 			transfer_tally = 0;
+			burst_tally = 0;
+			cache = NULL;
+			flushed_lines = 0;
+			minion_id = 0;
 			in_use = false;
+			dram_busy = false;
+			dram_req_stream = false;
+			dram_req_pending = false;
+			prefetch_depth = 0;
+			prefetch_head = 0;
+			stream_valid = false;
+			prefetch_fetch_addr = 0;
+			prefetch_fetching = 0;
+			prefetch_stale = false;
+			candidate_next = 0;
+			tally_prefetched = 0;
+			tally_prefetch_used = 0;
+			tally_prefetch_discarded = 0;
+			tally_stream_read_words = 0;
+			write_buffer_depth = 0;
+			tally_posted_writes = 0;
+			tally_write_drains = 0;
+			tally_write_forwarded = 0;
+			write_buffer_peak = 0;
+			write_buffer_stall = SC_ZERO_TIME;
+			drain_pending = 0;
+			interleave_words = CACHE_LINE_BYTES / sizeof(unsigned int);
+			bus_chunk.resize(fifo_chunk());
+			dram_chunk.resize(fifo_chunk());
+			
+			minion_socket.register_b_transport(this, &Cross_Bus::b_transport);
+			minion_socket.register_get_direct_mem_ptr(this, &Cross_Bus::get_direct_mem_ptr);
 			
 			SC_THREAD(internal_bus_thread);
 				sensitive << internal_clk.pos();
 			
+			SC_THREAD(split_read_thread);
+				sensitive << internal_clk.pos();
+			
 			SC_THREAD(external_bus_thread);
 				sensitive << external_clk.pos();
 		}
 		
+		~Cross_Bus(){
+			delete cache;
+			for(unsigned int i = 0; i < channel_event.size(); i++){
+				delete channel_event[i];
+			}
+		}
+		
+		//One channel_thread per bound DRAM
+		void end_of_elaboration(){
+			unsigned int n = (unsigned int) dram_if.size();
+			channel_queue.resize(n);
+			tally_channel_words.assign(n, 0);
+			channel_busy.assign(n, SC_ZERO_TIME);
+			for(unsigned int c = 0; c < n; c++){
+				channel_event.push_back(new sc_event());
+				sc_spawn(sc_bind(&Cross_Bus::channel_thread, this, c), sc_gen_unique_name("channel_thread"));
+			}
+		}
+		
+		unsigned int num_channels(){
+			return (unsigned int) dram_if.size();
+		}
+		
+		void enable_cache(const cache_config &cfg){
+			delete cache;
+			cache = new dram_cache(cfg);
+		}
+		
+		/*
+		Write the dirty cache lines back at the end of the run, one line burst each. Called from a
+		thread once the masters are done. The loosely-timed path charges them like cached_delay.
+		*/
+		void flush_cache(){
+			if(cache == NULL){
+				return;
+			}
+			std::vector<unsigned int> lines = cache->flush();
+			for(unsigned int i = 0; i < lines.size(); i++){
+				if(internal_bus.size() == 0){
+					wait(sc_time(EXT_CLK_PERIOD_NS, SC_NS) * (double) channel_cycles(lines[i], true, cache->line_words()));
+					transfer_tally += cache->line_words();
+					burst_tally += 1;
+				} else {
+					dram_burst(OP_WRITE, lines[i], cache->line_words());
+				}
+			}
+			flushed_lines = (unsigned int) lines.size();
+		}
+		
 		/*
 		This thread handles the internal bus interface. It waits until the external address has
 		been called, then signals the external thread to access the DRAM. 
 		*/
 		void internal_bus_thread(){
+			if(internal_bus.size() == 0){
+				return; //loosely-timed system, requests come in on minion_socket
+			}
 			wait(); //first wait is for the initialization
 			while(true){
-				//When Listen() returns, we can check if this call is for our module
-				internal_bus->Listen(req_addr, req_op, req_len);
+				//Listen() only returns requests decoded to our range (the DRAM)
+				internal_bus->Listen(minion_id, req_addr, req_op, req_len);
 				
-				//This request is for the memory, check the operation and size:
-				if(req_addr >= DRAM_BASE_ADDR && req_addr < DRAM_BASE_ADDR + DRAM_SIZE){
-					internal_bus->Acknowledge(); //ack the request, then fulfil the operation
-					
-					for(unsigned int i = 0; i < req_len; i++){
-						dram_req_addr = req_addr + i;
-						if(req_op == OP_READ){
-							//read operation
-							wait(); //wait for the positive clock edge so that we follow bus protocols
-							dram_access_event.notify();
-							wait(dram_done_event);
-							internal_bus->SendReadData(rdata);
-						} else if (req_op == OP_WRITE){
-							//write
-							internal_bus->ReceiveWriteData(wdata);
-							dram_access_event.notify();
-							wait(dram_done_event);
-						} else {
-							//invalid
-							cout << "ERROR: INVALID OPERATION IN CROSS_BUS MODULE!\n";
-						}
+				if(req_op == OP_READ_SPLIT){
+					//split read: queue it for split_read_thread and let the bus go
+					split_read rd;
+					rd.addr = req_addr;
+					rd.len = req_len;
+					rd.tag = internal_bus->AcceptRead();
+					split_queue.push_back(rd);
+					split_queue_event.notify();
+					continue;
+				}
+				
+				internal_bus->Acknowledge(); //ack the request, then fulfil the operation
+				
+				if(cache == NULL && req_op == OP_WRITE && write_buffer_depth > 0){
+					post_writes(req_addr, req_len);
+					continue;
+				}
+				if(cache == NULL && (req_op == OP_READ || req_op == OP_WRITE)){
+					stream_burst(req_op, req_addr, req_len, NULL);
+					continue;
+				}
+				
+				//through the cache one word at a time
+				for(unsigned int i = 0; i < req_len; i++){
+					if(req_op == OP_READ){
+						//read operation
+						wait(); //wait for the positive clock edge so that we follow bus protocols
+						memory_access(OP_READ, req_addr + i, rdata);
+						internal_bus->SendReadData(rdata);
+					} else if (req_op == OP_WRITE){
+						//write
+						internal_bus->ReceiveWriteData(wdata);
+						memory_access(OP_WRITE, req_addr + i, wdata);
+					} else {
+						//invalid
+						LOG_ERROR(LOG_XBUS, "INVALID OPERATION IN CROSS_BUS MODULE!");
+					}
+				}
+			}
+			
+		}
+		
+		/*
+		This thread serves the queued split reads in order. The internal bus is free while it waits
+		on the DRAM, the data goes back to the requesting master on the response channel.
+		*/
+		void split_read_thread(){
+			unsigned int word;
+			if(internal_bus.size() == 0){
+				return;
+			}
+			wait();
+			while(true){
+				while(split_queue.empty()){
+					wait(split_queue_event);
+				}
+				split_read rd = split_queue.front();
+				if(cache == NULL){
+					stream_burst(OP_READ, rd.addr, rd.len, &rd);
+				}
+				for(unsigned int i = 0; i < rd.len && cache != NULL; i++){
+					wait(); //start the access on an internal clock edge, as for blocking reads
+					memory_access(OP_READ, rd.addr + i, word);
+					internal_bus->SendResponse(rd.tag, &word, 1);
+				}
+				split_queue.pop_front();
+			}
+		}
+		
+		//One word access from the internal bus, through the cache when there is one
+		void memory_access(unsigned int op, unsigned int addr, unsigned int &data){
+			if(cache == NULL){
+				dram_access(op, addr, data);
+				return;
+			}
+			dram_cache::result r = cache->access(addr, op == OP_WRITE);
+			if(r.writeback){
+				dram_burst(OP_WRITE, r.writeback_addr, cache->line_words());
+			}
+			if(r.fill){
+				dram_burst(OP_READ, r.fill_addr, cache->line_words());
+			}
+			if(r.write_through){
+				dram_access(OP_WRITE, addr, data);
+			} else if(op == OP_READ){
+				dram_if->Peek(addr, data);
+			} else {
+				dram_if->Poke(addr, data);
+			}
+		}
+		
+		//Words moved across the FIFO at a time, half its depth
+		static unsigned int fifo_chunk(){
+			return CROSS_BUS_FIFO_DEPTH > 1 ? CROSS_BUS_FIFO_DEPTH / 2 : 1;
+		}
+		
+		/*
+		Forward a whole bus burst to the DRAM as one streamed burst. Read data goes back on the bus,
+		or on the response channel of a split read, half a FIFO at a time as it arrives. Write data
+		is taken off the bus half a FIFO at a time as the FIFO drains.
+		*/
+		void stream_burst(unsigned int op, unsigned int addr, unsigned int len, const split_read *split){
+			dram_lock.lock();
+			dram_req_op = op;
+			dram_req_addr = addr;
+			dram_req_len = len;
+			dram_req_stream = true;
+			dram_busy = true;
+			dram_req_pending = true;
+			dram_access_event.notify();
+			
+			for(unsigned int done = 0; done < len; ){
+				unsigned int n = std::min(len - done, fifo_chunk());
+				if(op == OP_READ){
+					while(fifo.size() < n){
+						wait(fifo_data_event);
+					}
+					wait(); //the words are picked up on the next internal clock edge
+					std::copy(fifo.begin(), fifo.begin() + n, bus_chunk.begin());
+					fifo.erase(fifo.begin(), fifo.begin() + n);
+					fifo_space_event.notify();
+					if(split != NULL){
+						internal_bus->SendResponse(split->tag, bus_chunk.data(), n);
+					} else {
+						internal_bus->SendReadBurst(bus_chunk.data(), n);
 					}
+				} else {
+					internal_bus->ReceiveWriteBurst(bus_chunk.data(), n);
+					while(CROSS_BUS_FIFO_DEPTH - fifo.size() < n){
+						wait(fifo_space_event);
+					}
+					fifo.insert(fifo.end(), bus_chunk.begin(), bus_chunk.begin() + n);
+					fifo_data_event.notify();
 				}
+				done += n;
 			}
 			
+			while(dram_busy){
+				wait(dram_done_event);
+			}
+			dram_req_stream = false;
+			dram_lock.unlock();
+		}
+		
+		//Take a bus write into the write buffer half a FIFO at a time, waiting only while it is full
+		void post_writes(unsigned int addr, unsigned int len){
+			for(unsigned int done = 0; done < len; ){
+				unsigned int n = std::min(std::min(len - done, fifo_chunk()), write_buffer_depth);
+				sc_time start = sc_time_stamp();
+				while(write_buffer_depth - write_buf.size() < n){
+					wait(write_space_event);
+				}
+				write_buffer_stall += sc_time_stamp() - start;
+				internal_bus->ReceiveWriteBurst(bus_chunk.data(), n);
+				for(unsigned int i = 0; i < n; i++){
+					posted_write w;
+					w.addr = addr + done + i;
+					w.data = bus_chunk[i];
+					write_buf.push_back(w);
+				}
+				tally_posted_writes += n;
+				write_buffer_peak = std::max(write_buffer_peak, (unsigned int) write_buf.size());
+				dram_access_event.notify(); //wakes the external thread if it is idle
+				done += n;
+			}
+		}
+		
+		//Hand one word access to the external bus thread and wait for it to complete
+		void dram_access(unsigned int op, unsigned int addr, unsigned int &data){
+			dram_lock.lock();
+			dram_req_op = op;
+			dram_req_addr = addr;
+			dram_req_len = 1;
+			if(op == OP_WRITE){
+				dram_data = data;
+			}
+			dram_req_pending = true;
+			dram_access_event.notify();
+			wait(dram_done_event);
+			data = dram_data;
+			dram_lock.unlock();
+		}
+		
+		//Burst a cache line between the cache and the DRAM, only the time and the tallies matter
+		void dram_burst(unsigned int op, unsigned int addr, unsigned int len){
+			dram_lock.lock();
+			dram_req_op = op;
+			dram_req_addr = addr;
+			dram_req_len = len;
+			dram_req_pending = true;
+			dram_access_event.notify();
+			wait(dram_done_event);
+			dram_lock.unlock();
 		}
 		
 		/*
@@ -129,16 +575,356 @@ class Cross_Bus : public sc_module {
 		void external_bus_thread(){
 			wait();
 			while(true){
-				wait(dram_access_event);
-				transfer_tally += 1; //keep track of transfers.
-				if(req_op == OP_READ){
-					//read
-					dram_if->Read(dram_req_addr, rdata);
-				} else{
-					//write
-					dram_if->Write(dram_req_addr, wdata);
+				while(!dram_req_pending){
+					if(!write_buf.empty() && drain_pending == 0){
+						drain_writes();
+					} else if(prefetch_wanted()){
+						prefetch();
+					} else if(drain_pending > 0){
+						wait(dram_access_event | channel_done_event);
+					} else {
+						wait(dram_access_event);
+					}
+				}
+				dram_req_pending = false;
+				if(dram_req_op == OP_WRITE){
+					prefetch_invalidate(dram_req_addr, dram_req_len);
+				}
+				
+				if(dram_req_stream){
+					//streamed burst, half a FIFO per DRAM burst
+					unsigned int prefetched = 0;
+					if(dram_req_op == OP_READ){
+						prefetched = prefetch_lookup(dram_req_addr, dram_req_len);
+					}
+					for(unsigned int done = 0; done < dram_req_len; ){
+						unsigned int n = std::min(dram_req_len - done, fifo_chunk());
+						if(dram_req_op == OP_READ){
+							while(CROSS_BUS_FIFO_DEPTH - fifo.size() < n){
+								wait(fifo_space_event);
+							}
+							//leading words from the prefetch buffer, the rest from the DRAM
+							unsigned int k = std::min(n, prefetched);
+							std::copy(prefetch_buf.begin(), prefetch_buf.begin() + k, dram_chunk.begin());
+							prefetch_buf.erase(prefetch_buf.begin(), prefetch_buf.begin() + k);
+							prefetched -= k;
+							if(k < n){
+								channel_access(OP_READ, dram_req_addr + done + k, dram_chunk.data() + k, n - k);
+								transfer_tally += n - k;
+								burst_tally += 1;
+							}
+							forward_writes(dram_req_addr + done, dram_chunk.data(), n);
+							fifo.insert(fifo.end(), dram_chunk.begin(), dram_chunk.begin() + n);
+							fifo_data_event.notify();
+						} else {
+							while(fifo.size() < n){
+								wait(fifo_data_event);
+							}
+							wait(); //the words are picked up on the next external clock edge
+							std::copy(fifo.begin(), fifo.begin() + n, dram_chunk.begin());
+							fifo.erase(fifo.begin(), fifo.begin() + n);
+							fifo_space_event.notify();
+							channel_access(OP_WRITE, dram_req_addr + done, dram_chunk.data(), n);
+							transfer_tally += n;
+							burst_tally += 1;
+						}
+						done += n;
+					}
+					dram_busy = false;
+					dram_done_event.notify();
+					continue;
 				}
+				if(dram_req_len > 1){
+					//line burst for the cache
+					channel_access(dram_req_op, dram_req_addr, NULL, dram_req_len);
+					transfer_tally += dram_req_len;
+					burst_tally += 1;
+					dram_done_event.notify();
+					continue;
+				}
+				transfer_tally += 1; //keep track of transfers.
+				channel_access(dram_req_op, dram_req_addr, &dram_data, 1);
 				dram_done_event.notify();
 			}
 		}
+		
+		//Channel of a DRAM word address
+		unsigned int channel_of(unsigned int addr){
+			return ((addr - DRAM_BASE_ADDR) / interleave_words) % num_channels();
+		}
+		
+		//Words from addr up to the end of its interleave unit, or len with one channel
+		unsigned int channel_piece(unsigned int addr, unsigned int len){
+			if(num_channels() == 1){
+				return len;
+			}
+			return std::min(len, interleave_words - (addr - DRAM_BASE_ADDR) % interleave_words);
+		}
+		
+		//Queue a DRAM access on the channels it spans, pending counts the pieces until they are done
+		void channel_issue(unsigned int op, unsigned int addr, unsigned int *data, unsigned int len, unsigned int &pending){
+			while(len > 0){
+				unsigned int n = channel_piece(addr, len);
+				channel_cmd cmd;
+				cmd.op = op;
+				cmd.addr = addr;
+				cmd.len = n;
+				cmd.data = data;
+				cmd.pending = &pending;
+				unsigned int c = channel_of(addr);
+				channel_queue[c].push_back(cmd);
+				channel_event[c]->notify();
+				pending++;
+				addr += n;
+				data = data ? data + n : NULL;
+				len -= n;
+			}
+		}
+		
+		//DRAM access on all the channels it spans, returns when every piece is done
+		void channel_access(unsigned int op, unsigned int addr, unsigned int *data, unsigned int len){
+			unsigned int pending = 0;
+			channel_issue(op, addr, data, len, pending);
+			while(pending > 0){
+				wait(channel_done_event);
+			}
+		}
+		
+		/*
+		The external bus of one channel. Runs the bursts queued for channel c in order, the head of
+		the queue stays there until its burst is done.
+		*/
+		void channel_thread(unsigned int c){
+			while(true){
+				while(channel_queue[c].empty()){
+					wait(*channel_event[c]);
+				}
+				channel_cmd cmd = channel_queue[c].front();
+				sc_time start = sc_time_stamp();
+				if(cmd.data == NULL){
+					unsigned int cycles = dram_if[c]->AccessCycles(cmd.addr, cmd.op == OP_WRITE, cmd.len);
+					for(unsigned int i = 0; i < cycles; i++){
+						wait(external_clk.posedge_event());
+					}
+				} else if(cmd.op == OP_READ){
+					dram_if[c]->ReadBurst(cmd.addr, cmd.data, cmd.len);
+				} else {
+					dram_if[c]->WriteBurst(cmd.addr, cmd.data, cmd.len);
+				}
+				channel_busy[c] += sc_time_stamp() - start;
+				tally_channel_words[c] += cmd.len;
+				channel_queue[c].pop_front();
+				(*cmd.pending)--;
+				channel_done_event.notify();
+			}
+		}
+		
+		//Cycles of a DRAM access split across its channels, the pieces on different channels overlap
+		unsigned int channel_cycles(unsigned int addr, bool write, unsigned int len){
+			if(num_channels() == 1){
+				return dram_if[0]->AccessCycles(addr, write, len);
+			}
+			std::vector<unsigned int> busy(num_channels(), 0);
+			while(len > 0){
+				unsigned int n = channel_piece(addr, len);
+				unsigned int c = channel_of(addr);
+				busy[c] += dram_if[c]->AccessCycles(addr, write, n);
+				tally_channel_words[c] += n;
+				addr += n;
+				len -= n;
+			}
+			for(unsigned int c = 0; c < num_channels(); c++){
+				channel_busy[c] += sc_time(EXT_CLK_PERIOD_NS, SC_NS) * (double) busy[c];
+			}
+			return *std::max_element(busy.begin(), busy.end());
+		}
+		
+		//Write the run of consecutive addresses at the head of the write buffer as one DRAM burst
+		void drain_writes(){
+			unsigned int addr = write_buf.front().addr;
+			unsigned int n = 0;
+			drain_data.resize(fifo_chunk());
+			while(n < write_buf.size() && n < fifo_chunk() && write_buf[n].addr == addr + n){
+				drain_data[n] = write_buf[n].data;
+				n++;
+			}
+			//the burst frees its entries, later reads of its words queue behind it on their channel
+			write_buf.erase(write_buf.begin(), write_buf.begin() + n);
+			write_space_event.notify();
+			wait(); //the words are picked up on the next external clock edge
+			prefetch_invalidate(addr, n);
+			channel_issue(OP_WRITE, addr, drain_data.data(), n, drain_pending);
+			transfer_tally += n;
+			burst_tally += 1;
+			tally_write_drains += 1;
+		}
+		
+		//Replace the words of a read that are still in the write buffer, newest last
+		void forward_writes(unsigned int addr, unsigned int *data, unsigned int len){
+			for(unsigned int i = 0; i < write_buf.size(); i++){
+				unsigned int offset = write_buf[i].addr - addr;
+				if(write_buf[i].addr >= addr && offset < len){
+					data[offset] = write_buf[i].data;
+					tally_write_forwarded += 1;
+				}
+			}
+		}
+		
+		//Prefetch while the stream is live and the buffer has room
+		bool prefetch_wanted(){
+			unsigned int next = prefetch_head + (unsigned int) prefetch_buf.size();
+			return stream_valid && prefetch_buf.size() < prefetch_depth && next < DRAM_BASE_ADDR + DRAM_SIZE;
+		}
+		
+		//Fetch the next half FIFO of the stream into the prefetch buffer
+		void prefetch(){
+			unsigned int next = prefetch_head + (unsigned int) prefetch_buf.size();
+			unsigned int n = std::min(fifo_chunk(), prefetch_depth - (unsigned int) prefetch_buf.size());
+			n = std::min(n, DRAM_BASE_ADDR + DRAM_SIZE - next);
+			prefetch_fetch_addr = next;
+			prefetch_fetching = n;
+			prefetch_stale = false;
+			channel_access(OP_READ, next, dram_chunk.data(), n);
+			prefetch_fetching = 0;
+			transfer_tally += n;
+			burst_tally += 1;
+			tally_prefetched += n;
+			if(prefetch_stale){
+				tally_prefetch_discarded += n;
+				return;
+			}
+			prefetch_buf.insert(prefetch_buf.end(), dram_chunk.begin(), dram_chunk.begin() + n);
+		}
+		
+		//Train the stream detector on a read, returns how many of its leading words are prefetched
+		unsigned int prefetch_lookup(unsigned int addr, unsigned int len){
+			tally_stream_read_words += len;
+			if(prefetch_depth == 0){
+				return 0;
+			}
+			unsigned int hit = 0;
+			if(stream_valid && addr >= prefetch_head && addr - prefetch_head <= prefetch_buf.size()){
+				//skip words the stream stepped over, e.g. the label after an image
+				unsigned int skip = addr - prefetch_head;
+				prefetch_buf.erase(prefetch_buf.begin(), prefetch_buf.begin() + skip);
+				tally_prefetch_discarded += skip;
+				hit = std::min(len, (unsigned int) prefetch_buf.size());
+			} else if(addr == candidate_next){
+				//second read in a row at sequential addresses, follow the new stream
+				tally_prefetch_discarded += prefetch_buf.size();
+				prefetch_buf.clear();
+				stream_valid = true;
+			} else {
+				candidate_next = addr + len;
+				return 0;
+			}
+			candidate_next = addr + len;
+			prefetch_head = addr + len; //the read consumes the buffer up to here
+			tally_prefetch_used += hit;
+			return hit;
+		}
+		
+		//The host rewrote len words from addr in the backing store, forget the copies of them
+		void HostWrite(unsigned int addr, unsigned int len){
+			size_t buffered = prefetch_buf.size();
+			prefetch_invalidate(addr, len);
+			//a prefetch in flight goes after the buffer, drop it if it reads the words or the buffer is gone
+			bool overlap = addr < prefetch_fetch_addr + prefetch_fetching && prefetch_fetch_addr < addr + len;
+			if(prefetch_fetching > 0 && (overlap || prefetch_buf.size() != buffered)){
+				prefetch_stale = true;
+			}
+			if(cache != NULL){
+				cache->invalidate(addr, len);
+			}
+		}
+		
+		//Drop prefetched words a write is about to change
+		void prefetch_invalidate(unsigned int addr, unsigned int len){
+			if(!prefetch_buf.empty() && addr < prefetch_head + prefetch_buf.size() && prefetch_head < addr + len){
+				tally_prefetch_discarded += prefetch_buf.size();
+				prefetch_buf.clear();
+			}
+		}
+		
+		/*
+		Loosely-timed access from tlm_bus. The words are copied without waiting on the external
+		clock, the DRAM cycles they would have taken are added to the delay instead.
+		*/
+		void b_transport(tlm::tlm_generic_payload &trans, sc_time &delay){
+			unsigned int addr = (unsigned int) trans.get_address();
+			unsigned int len = trans.get_data_length() / sizeof(unsigned int);
+			unsigned int *data = (unsigned int *) trans.get_data_ptr();
+			bool ok = true;
+			
+			for(unsigned int i = 0; i < len && ok; i++){
+				if(trans.is_read()){
+					ok = dram_if->Peek(addr + i, data[i]);
+				} else if(trans.is_write()){
+					ok = dram_if->Poke(addr + i, data[i]);
+				}
+			}
+			if(!ok){
+				trans.set_response_status(tlm::TLM_ADDRESS_ERROR_RESPONSE);
+				return;
+			}
+			
+			//ignored commands account for reads already done through DMI
+			if(cache != NULL){
+				delay += cached_delay(addr, len, trans.is_write());
+			} else {
+				unsigned int cycles = 0;
+				for(unsigned int done = 0; done < len; done += fifo_chunk()){
+					//one DRAM burst per half FIFO, as on the pin-level path
+					cycles += channel_cycles(addr + done, trans.is_write(), std::min(len - done, fifo_chunk()));
+					burst_tally += 1;
+				}
+				delay += sc_time(EXT_CLK_PERIOD_NS, SC_NS) * (double) cycles;
+				transfer_tally += len; //same tally as the pin-level path
+			}
+			trans.set_response_status(tlm::TLM_OK_RESPONSE);
+		}
+		
+		//Time the pin-level path would take for len words through the cache, with the same tallies
+		sc_time cached_delay(unsigned int addr, unsigned int len, bool write){
+			sc_time int_period(INT_CLK_PERIOD_NS, SC_NS);
+			sc_time ext_period(EXT_CLK_PERIOD_NS, SC_NS);
+			sc_time total = SC_ZERO_TIME;
+			for(unsigned int i = 0; i < len; i++){
+				dram_cache::result r = cache->access(addr + i, write);
+				if(!write){
+					total += int_period; //reads start on an internal clock edge
+				}
+				if(r.writeback){
+					total += ext_period * (double) channel_cycles(r.writeback_addr, true, cache->line_words());
+					transfer_tally += cache->line_words();
+					burst_tally += 1;
+				}
+				if(r.fill){
+					total += ext_period * (double) channel_cycles(r.fill_addr, false, cache->line_words());
+					transfer_tally += cache->line_words();
+					burst_tally += 1;
+				}
+				if(r.write_through){
+					total += ext_period * (double) channel_cycles(addr + i, true, 1);
+					transfer_tally += 1;
+				}
+			}
+			return total;
+		}
+		
+		//DMI into the DRAM backing store. Addresses are word addresses, as on the bus.
+		bool get_direct_mem_ptr(tlm::tlm_generic_payload &/*trans*/, tlm::tlm_dmi &dmi){
+			unsigned int words;
+			unsigned int *store = dram_if->DirectPointer(DRAM_BASE_ADDR, words);
+			if(store == NULL){
+				return false;
+			}
+			dmi.set_dmi_ptr((unsigned char *) store);
+			dmi.set_start_address(DRAM_BASE_ADDR);
+			dmi.set_end_address(DRAM_BASE_ADDR + words - 1);
+			dmi.set_read_latency(sc_time(EXT_CLK_PERIOD_NS, SC_NS) * (double) DRAM_READ_CYCLES);
+			dmi.set_write_latency(sc_time(EXT_CLK_PERIOD_NS, SC_NS) * (double) DRAM_WRITE_CYCLES);
+			dmi.allow_read_write();
+			return true;
+		}
 };
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <systemc.h>
+#include "project_include.h"
+#include "dram_preload.h"
+#include "sim_log.h"
+
+/*************************************************************
+Dataset_Loader.h streams a range of the MNIST test set into
+DRAM while the CPU works through it, instead of preloading
+the whole test set before the simulation starts. The images
+pass through a ring of DATASET_RING_SLOTS slots starting where
+the preloaded test set would be, each slot one image in the
+preloaded layout (MNIST_IMAGE_WORDS words, the label last), so
+the CPU and the control unit read them exactly as before.
+
+The CPU acquires image i of the run before it hands it to the
+control unit and releases it once it has read the label (with
+batched results once the control unit has the image). The
+loader thread fills every free slot as soon as it is released,
+reading the files one image at a time, so startup does not
+wait for the test set and neither the host memory nor the DRAM
+pages in use grow with the number of images.
+
+TIMING:
+	The loader stands in for the host filling the DRAM, so it
+	writes the backing store through DirectPointer and takes
+	no simulation time. The CPU never waits for it as long as
+	the ring has a slot ahead of the image in use, and the
+	run times match those of the preloaded test set (bank
+	model aside, the addresses differ).
+
+LABELS:
+	With label_slots set the loader also copies the label of
+	every image into a ring of label_slots bytes at labels,
+	packed EIE_RESULTS_PER_WORD to a word, the label of image
+	i of the run in byte i % label_slots, for the CPU to
+	read the labels of a batch in one burst (see
+	EIE_SW_module, BATCHED RESULTS). The slots are not
+	tracked: the top module makes the ring long enough that a
+	batch is read back before the loader, at most
+	DATASET_RING_SLOTS images ahead, comes round to it.
+
+COHERENCE:
+	A refill bypasses the Cross_Bus, which may still hold
+	the slot's previous image in its prefetch buffer or
+	cache tags. Every refill is reported through the
+	coherence port so those copies are dropped and the next
+	read of the slot goes to the DRAM as a read of a fresh
+	image in the preloaded test set would.
+*************************************************************/
+
+class dataset_if : virtual public sc_interface {
+public:
+    // block until image index of the run is in DRAM, returns its word offset from DRAM_BASE_ADDR
+    virtual unsigned int Acquire(unsigned int index) = 0;
+    // the CPU is done with image index, its slot may be refilled
+    virtual void Release(unsigned int index) = 0;
+};
+
+class dataset_loader : public sc_module, public dataset_if {
+private:
+    mnist_reader reader;
+    unsigned int base;     // word offset of slot 0
+    unsigned int loaded;   // images of the run in DRAM so far
+    unsigned int released; // images the CPU is done with
+    sc_event loaded_event, released_event;
+
+public:
+    sc_port<simple_mem_if> dram;
+    sc_port<dram_coherence_if, 1, SC_ZERO_OR_MORE_BOUND> coherence; // the Cross_Bus in front of dram
+
+    unsigned int first; // index of the first image in the test set
+    unsigned int count; // images in the run
+
+    // word offset of the label ring and its length in labels, 0 for none
+    unsigned int labels, label_slots;
+
+    SC_HAS_PROCESS(dataset_loader);
+
+    /*
+    Stream count images of the test set from image first into the ring at word offset
+    ring_base. A range past the end of the test set is cut short with an error.
+    */
+    dataset_loader(sc_module_name name, unsigned int first_image, unsigned int images, unsigned int ring_base)
+        : sc_module(name)
+        , base(ring_base)
+        , loaded(0)
+        , released(0)
+        , first(first_image)
+        , count(images)
+        , labels(0)
+        , label_slots(0) {
+        if (!reader.open(first) || reader.images - first < count) {
+            unsigned int available = first < reader.images ? reader.images - first : 0;
+            LOG_ERROR(LOG_LOADER, "MNIST/ HOLDS " << reader.images << " TEST IMAGES, STREAMING " << available << " FROM IMAGE " << first);
+            count = available;
+        }
+        SC_THREAD(loader_thread);
+    }
+
+    unsigned int Acquire(unsigned int index) {
+        while (loaded <= index) {
+            wait(loaded_event);
+        }
+        return slot_offset(index);
+    }
+
+    void Release(unsigned int index) {
+        if (index + 1 > released) {
+            released = index + 1;
+            released_event.notify();
+        }
+    }
+
+private:
+    unsigned int slot_offset(unsigned int index) {
+        return base + (index % DATASET_RING_SLOTS) * MNIST_IMAGE_WORDS;
+    }
+
+    void loader_thread() {
+        for (unsigned int i = 0; i < count; i++) {
+            // the slot of image i still holds image i - DATASET_RING_SLOTS until that is released
+            while (i >= released + DATASET_RING_SLOTS) {
+                wait(released_event);
+            }
+            unsigned int len = 0;
+            unsigned int *slot = dram->DirectPointer(DRAM_BASE_ADDR + slot_offset(i), len);
+            if (slot == NULL || len < MNIST_IMAGE_WORDS) {
+                SC_REPORT_ERROR(name(), "the dataset ring does not fit the DRAM");
+                return;
+            }
+            if (!reader.next(slot)) {
+                LOG_ERROR(LOG_LOADER, "CANNOT READ TEST IMAGE " << first + i);
+            }
+            if (coherence.size() > 0) {
+                coherence->HostWrite(DRAM_BASE_ADDR + slot_offset(i), MNIST_IMAGE_WORDS);
+            }
+            if (label_slots > 0) {
+                unsigned int word = labels + i % label_slots / EIE_RESULTS_PER_WORD;
+                unsigned int shift = 8 * (i % label_slots % EIE_RESULTS_PER_WORD);
+                unsigned int *label = dram->DirectPointer(DRAM_BASE_ADDR + word, len);
+                if (label == NULL) {
+                    SC_REPORT_ERROR(name(), "the label ring does not fit the DRAM");
+                    return;
+                }
+                *label = (*label & ~(0xffu << shift)) | ((slot[28 * 28] & 0xff) << shift);
+                if (coherence.size() > 0) {
+                    coherence->HostWrite(DRAM_BASE_ADDR + word, 1);
+                }
+            }
+            loaded = i + 1;
+            loaded_event.notify();
+        }
+    }
+};
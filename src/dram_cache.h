@@ -0,0 +1,275 @@
+#pragma once
+
+/*************************************************************
+DRAM_Cache.h is the tag and replacement model of the optional
+cache inside the Cross_Bus. It is set associative with a
+configurable size, associativity and line size, write-back
+(write-allocate) or write-through (no write-allocate), and
+true LRU or tree pseudo-LRU replacement.
+
+The cache only tracks state: every access returns what the
+Cross_Bus has to do on the external bus (write back a victim,
+fill a line, write a word through) and the words themselves
+always live in the DRAM backing store. Timing and energy
+therefore follow the cache while the data seen by every
+master, DMI included, stays coherent without a flush. flush()
+only settles the accounts: it cleans the dirty lines and
+hands back their write-backs to be charged.
+
+Addresses are the word addresses of the internal bus, line
+and cache sizes are given in bytes.
+
+POWER MODELLING:
+	Every lookup reads the tags of all ways of a set and is
+	counted in tally_tag_lookups (times the ways). Every word
+	read from or written to the data array, by the bus or by
+	a line fill or write-back, is counted in tally_data_words.
+	The energy per tag and per data word is applied in
+	eie_main.
+*************************************************************/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <project_include.h>
+#include "sim_log.h"
+
+struct cache_config {
+    unsigned int size_bytes;
+    unsigned int ways;
+    unsigned int line_bytes;
+    bool write_back; // write-back with write-allocate, else write-through without
+    bool plru;       // tree pseudo-LRU, else true LRU
+
+    cache_config() {
+        size_bytes = CACHE_SIZE_BYTES;
+        ways = CACHE_WAYS;
+        line_bytes = CACHE_LINE_BYTES;
+        write_back = true;
+        plru = false;
+    }
+};
+
+class dram_cache {
+private:
+    struct cache_line {
+        unsigned int tag;
+        bool valid;
+        bool dirty;
+        unsigned long long last_use; // LRU stamp
+    };
+
+    cache_config cfg;
+    unsigned int words_per_line;
+    unsigned int num_sets;
+    unsigned int plru_levels;
+    std::vector<cache_line> lines;      // num_sets * ways, set-major
+    std::vector<unsigned int> plru_tree; // ways - 1 node bits per set
+    unsigned long long use_clock;
+
+    static bool power_of_two(unsigned int x) {
+        return x != 0 && (x & (x - 1)) == 0;
+    }
+
+    void touch(unsigned int set, unsigned int way) {
+        lines[set * cfg.ways + way].last_use = ++use_clock;
+        if (!cfg.plru) {
+            return;
+        }
+        // point every node on the path away from the way just used
+        unsigned int node = 0;
+        for (unsigned int l = 0; l < plru_levels; l++) {
+            unsigned int bit = (way >> (plru_levels - 1 - l)) & 1;
+            if (bit) {
+                plru_tree[set] &= ~(1u << node);
+            } else {
+                plru_tree[set] |= 1u << node;
+            }
+            node = 2 * node + 1 + bit;
+        }
+    }
+
+    unsigned int victim(unsigned int set) const {
+        const cache_line *s = &lines[set * cfg.ways];
+        for (unsigned int w = 0; w < cfg.ways; w++) {
+            if (!s[w].valid) {
+                return w;
+            }
+        }
+        if (cfg.plru) {
+            unsigned int node = 0, way = 0;
+            for (unsigned int l = 0; l < plru_levels; l++) {
+                unsigned int bit = (plru_tree[set] >> node) & 1;
+                way = (way << 1) | bit;
+                node = 2 * node + 1 + bit;
+            }
+            return way;
+        }
+        unsigned int lru = 0;
+        for (unsigned int w = 1; w < cfg.ways; w++) {
+            if (s[w].last_use < s[lru].last_use) {
+                lru = w;
+            }
+        }
+        return lru;
+    }
+
+public:
+    // what the Cross_Bus has to do on the external bus for one word access
+    struct result {
+        bool hit;
+        bool writeback;          // burst the victim line at writeback_addr to the DRAM first
+        bool fill;               // then burst the line at fill_addr in from the DRAM
+        bool write_through;      // the word itself goes to the DRAM
+        unsigned int writeback_addr;
+        unsigned int fill_addr;
+    };
+
+    unsigned long long read_hits, read_misses;
+    unsigned long long write_hits, write_misses;
+    unsigned long long line_fills, line_writebacks;
+    unsigned long long tally_tag_lookups, tally_data_words;
+
+    dram_cache(const cache_config &config)
+        : cfg(config)
+        , use_clock(0)
+        , read_hits(0)
+        , read_misses(0)
+        , write_hits(0)
+        , write_misses(0)
+        , line_fills(0)
+        , line_writebacks(0)
+        , tally_tag_lookups(0)
+        , tally_data_words(0) {
+        if (!valid(cfg)) {
+            LOG_ERROR(LOG_XBUS, "INVALID CACHE GEOMETRY, USING THE DEFAULT");
+            cfg = cache_config();
+        }
+        words_per_line = cfg.line_bytes / sizeof(unsigned int);
+        num_sets = cfg.size_bytes / cfg.line_bytes / cfg.ways;
+        plru_levels = 0;
+        while ((1u << plru_levels) < cfg.ways) {
+            plru_levels++;
+        }
+
+        cache_line empty;
+        empty.tag = 0;
+        empty.valid = false;
+        empty.dirty = false;
+        empty.last_use = 0;
+        lines.assign(num_sets * cfg.ways, empty);
+        plru_tree.assign(num_sets, 0);
+    }
+
+    // power-of-two line, ways and sets, at least one word per line and at most 32 ways
+    static bool valid(const cache_config &c) {
+        if (c.line_bytes < sizeof(unsigned int) || !power_of_two(c.line_bytes) || !power_of_two(c.ways) || c.ways > 32) {
+            return false;
+        }
+        if (c.size_bytes < c.line_bytes * c.ways || c.size_bytes % (c.line_bytes * c.ways) != 0) {
+            return false;
+        }
+        return power_of_two(c.size_bytes / c.line_bytes / c.ways);
+    }
+
+    const cache_config &config() const {
+        return cfg;
+    }
+
+    unsigned int line_words() const {
+        return words_per_line;
+    }
+
+    result access(unsigned int addr, bool write) {
+        result r;
+        r.hit = false;
+        r.writeback = false;
+        r.fill = false;
+        r.write_through = false;
+        r.writeback_addr = 0;
+        r.fill_addr = 0;
+
+        unsigned int line_addr = addr / words_per_line;
+        unsigned int set = line_addr & (num_sets - 1);
+        unsigned int tag = line_addr / num_sets;
+        cache_line *s = &lines[set * cfg.ways];
+        tally_tag_lookups += cfg.ways;
+
+        for (unsigned int w = 0; w < cfg.ways; w++) {
+            if (s[w].valid && s[w].tag == tag) {
+                r.hit = true;
+                touch(set, w);
+                tally_data_words++;
+                if (write) {
+                    write_hits++;
+                    if (cfg.write_back) {
+                        s[w].dirty = true;
+                    } else {
+                        r.write_through = true;
+                    }
+                } else {
+                    read_hits++;
+                }
+                return r;
+            }
+        }
+
+        if (write) {
+            write_misses++;
+            if (!cfg.write_back) {
+                r.write_through = true; // no write-allocate
+                return r;
+            }
+        } else {
+            read_misses++;
+        }
+
+        unsigned int w = victim(set);
+        if (s[w].valid && s[w].dirty) {
+            r.writeback = true;
+            r.writeback_addr = (s[w].tag * num_sets + set) * words_per_line;
+            line_writebacks++;
+            tally_data_words += words_per_line;
+        }
+        r.fill = true;
+        r.fill_addr = line_addr * words_per_line;
+        line_fills++;
+        tally_data_words += words_per_line + 1;
+
+        s[w].tag = tag;
+        s[w].valid = true;
+        s[w].dirty = write;
+        touch(set, w);
+        return r;
+    }
+
+    // drop the lines holding any of the len words from addr without writing them back
+    void invalidate(unsigned int addr, unsigned int len) {
+        if (len == 0) {
+            return;
+        }
+        for (unsigned int line_addr = addr / words_per_line; line_addr <= (addr + len - 1) / words_per_line; line_addr++) {
+            cache_line *s = &lines[(line_addr & (num_sets - 1)) * cfg.ways];
+            for (unsigned int w = 0; w < cfg.ways; w++) {
+                if (s[w].valid && s[w].tag == line_addr / num_sets) {
+                    s[w].valid = false;
+                    s[w].dirty = false;
+                }
+            }
+        }
+    }
+
+    // clean every dirty line, counted as write-backs, and return the word addresses to write back
+    std::vector<unsigned int> flush() {
+        std::vector<unsigned int> addrs;
+        for (unsigned int i = 0; i < lines.size(); i++) {
+            if (lines[i].valid && lines[i].dirty) {
+                addrs.push_back((lines[i].tag * num_sets + i / cfg.ways) * words_per_line);
+                lines[i].dirty = false;
+                line_writebacks++;
+                tally_data_words += words_per_line;
+            }
+        }
+        return addrs;
+    }
+};
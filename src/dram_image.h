@@ -0,0 +1,278 @@
+#pragma once
+
+/*************************************************************
+DRAM_Image.h is the binary preload image of the DRAM: the
+weights and the test set exactly as they sit in the backing
+store, written once by dram_image_convert and mapped into the
+DRAM at startup instead of parsing the text weights and the
+MNIST files on every run.
+
+FILE FORMAT:
+	A dram_image_header, region_count dram_image_region
+	entries and, at payload_offset (a multiple of
+	DRAM_IMAGE_ALIGN bytes), payload_words words in host byte
+	order that go to DRAM offset 0 onwards. The file is
+	padded to a multiple of DRAM_IMAGE_ALIGN.
+
+	Every region (a weight layer, the test set) carries an
+	FNV-1a checksum of its words and the header one of itself
+	and the region table, so a stale or damaged image is
+	rejected instead of silently running on wrong data. The
+	header also records TEST_IMAGES, NUM_LAYERS and the layer
+	sizes the image was built for, and every dense weight
+	layer and the test set must hold exactly the words those
+	give, so an image in an older layout of the same network
+	is rejected too.
+
+MAPPING:
+	The payload is mapped copy-on-write with MAP_FIXED over
+	the start of the DRAM's anonymous mapping. Pages stay in
+	the page cache and are shared by every simulation mapping
+	the same image until one of them writes to a page. If the
+	payload cannot be mapped (e.g. a page size larger than
+	DRAM_IMAGE_ALIGN) it is read into the store instead.
+*************************************************************/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "dram_preload.h"
+
+#define DRAM_IMAGE_MAGIC "EIEDIMG1"
+//2: dense layers hold exactly rows * cols words (the text parser of version 1 added one per layer)
+#define DRAM_IMAGE_VERSION 2
+#define DRAM_IMAGE_ALIGN 4096
+#define DRAM_IMAGE_NAME_LEN 24
+
+struct dram_image_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t region_count;
+    uint64_t payload_offset; // bytes from the start of the file
+    uint32_t payload_words;
+    uint32_t test_images;
+    uint32_t num_layers;
+    uint32_t layer_sizes[16]; // the first num_layers + 1 are used
+    uint32_t reserved;
+    uint64_t checksum;       // header (with this field 0) and region table
+};
+
+struct dram_image_region {
+    char name[DRAM_IMAGE_NAME_LEN];
+    uint32_t offset; // words from DRAM_BASE_ADDR
+    uint32_t words;
+    uint64_t checksum;
+};
+
+// 64-bit FNV-1a over whole words
+inline uint64_t dram_image_checksum(const void *data, size_t bytes, uint64_t h = 14695981039346656037ULL) {
+    const unsigned char *p = (const unsigned char *) data;
+    for (size_t i = 0; i < bytes; i++) {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+inline uint64_t dram_image_words_checksum(const unsigned int *words, size_t n) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ words[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+inline uint64_t dram_image_table_checksum(dram_image_header header, const std::vector<dram_image_region> &table) {
+    header.checksum = 0;
+    uint64_t h = dram_image_checksum(&header, sizeof(header));
+    return table.empty() ? h : dram_image_checksum(table.data(), table.size() * sizeof(dram_image_region), h);
+}
+
+// fill in the build parameters this simulator expects
+inline void dram_image_fill_params(dram_image_header &header) {
+    unsigned int layersizes[NUM_LAYERS + 1] = LAYER_SIZES;
+    memset(header.layer_sizes, 0, sizeof(header.layer_sizes));
+    header.test_images = TEST_IMAGES;
+    header.num_layers = NUM_LAYERS;
+    for (unsigned int i = 0; i <= NUM_LAYERS; i++) {
+        header.layer_sizes[i] = layersizes[i];
+    }
+}
+
+/*
+Check the region lengths against LAYER_SIZES and TEST_IMAGES: every dense weight layer
+must be there with rows * cols words and the test set with TEST_IMAGES images. Packed
+layers (a weight_dir region) vary in length and are left to the unpacker.
+*/
+inline bool dram_image_check_lengths(const std::vector<dram_image_region> &table, std::string &error) {
+    unsigned int layersizes[NUM_LAYERS + 1] = LAYER_SIZES;
+    bool packed = false;
+    for (unsigned int i = 0; i < table.size(); i++) {
+        packed = packed || std::string(table[i].name, strnlen(table[i].name, DRAM_IMAGE_NAME_LEN)) == "weight_dir";
+    }
+    unsigned int layers_found = 0;
+    for (unsigned int i = 0; i < table.size(); i++) {
+        std::string name(table[i].name, strnlen(table[i].name, DRAM_IMAGE_NAME_LEN));
+        uint64_t expected = 0;
+        if (name == "test_set") {
+            expected = (uint64_t) TEST_IMAGES * MNIST_IMAGE_WORDS;
+        }
+        for (unsigned int l = 0; l < NUM_LAYERS && !packed; l++) {
+            if (name == "weight_l" + std::to_string(l)) {
+                expected = (uint64_t) layersizes[l] * layersizes[l + 1];
+                layers_found++;
+            }
+        }
+        if (expected != 0 && table[i].words != expected) {
+            error = "region " + name + " holds " + std::to_string(table[i].words) + " words, expected " + std::to_string(expected);
+            return false;
+        }
+    }
+    if (!packed && layers_found != NUM_LAYERS) {
+        error = "image has " + std::to_string(layers_found) + " of " + std::to_string(NUM_LAYERS) + " weight layers";
+        return false;
+    }
+    return true;
+}
+
+// write the first payload_words words of mem and the regions in them, false (with error set) on failure
+inline bool write_dram_image(const std::string &path, const unsigned int *mem, unsigned int payload_words,
+                             const std::vector<dram_region> &regions, std::string &error) {
+    dram_image_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DRAM_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = DRAM_IMAGE_VERSION;
+    header.region_count = (uint32_t) regions.size();
+    size_t table_end = sizeof(header) + regions.size() * sizeof(dram_image_region);
+    header.payload_offset = (table_end + DRAM_IMAGE_ALIGN - 1) / DRAM_IMAGE_ALIGN * DRAM_IMAGE_ALIGN;
+    header.payload_words = payload_words;
+    dram_image_fill_params(header);
+
+    std::vector<dram_image_region> table(regions.size());
+    for (unsigned int i = 0; i < regions.size(); i++) {
+        memset(&table[i], 0, sizeof(dram_image_region));
+        strncpy(table[i].name, regions[i].name.c_str(), DRAM_IMAGE_NAME_LEN - 1);
+        table[i].offset = regions[i].offset;
+        table[i].words = regions[i].words;
+        table[i].checksum = dram_image_words_checksum(mem + regions[i].offset, regions[i].words);
+    }
+    header.checksum = dram_image_table_checksum(header, table);
+
+    FILE *out = fopen(path.c_str(), "wb");
+    if (out == NULL) {
+        error = "cannot create " + path;
+        return false;
+    }
+    size_t payload_bytes = (size_t) payload_words * sizeof(unsigned int);
+    size_t padded = (payload_bytes + DRAM_IMAGE_ALIGN - 1) / DRAM_IMAGE_ALIGN * DRAM_IMAGE_ALIGN;
+    std::vector<char> zeros(DRAM_IMAGE_ALIGN, 0);
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && (table.empty() || fwrite(table.data(), sizeof(dram_image_region), table.size(), out) == table.size());
+    ok = ok && fwrite(zeros.data(), 1, header.payload_offset - table_end, out) == header.payload_offset - table_end;
+    ok = ok && fwrite(mem, 1, payload_bytes, out) == payload_bytes;
+    ok = ok && fwrite(zeros.data(), 1, padded - payload_bytes, out) == padded - payload_bytes;
+    ok = (fclose(out) == 0) && ok;
+    if (!ok) {
+        error = "cannot write " + path;
+    }
+    return ok;
+}
+
+/*
+Map the image at path over mem, which holds capacity words and must be page aligned. The
+regions are checked against their checksums before returning true. On failure error says
+why and mem may hold part of the image.
+*/
+inline bool map_dram_image(const std::string &path, unsigned int *mem, unsigned int capacity,
+                           std::vector<dram_region> &regions, std::string &error) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "cannot open " + path;
+        return false;
+    }
+    struct stat st;
+    dram_image_header header;
+    if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)
+        || memcmp(header.magic, DRAM_IMAGE_MAGIC, sizeof(header.magic)) != 0) {
+        error = path + " is not a DRAM image";
+        close(fd);
+        return false;
+    }
+    if (header.version != DRAM_IMAGE_VERSION) {
+        error = path + " has unsupported version " + std::to_string(header.version);
+        close(fd);
+        return false;
+    }
+
+    std::vector<dram_image_region> table(header.region_count);
+    size_t table_bytes = table.size() * sizeof(dram_image_region);
+    if (header.region_count > 1024 || (table_bytes > 0 && pread(fd, table.data(), table_bytes, sizeof(header)) != (ssize_t) table_bytes)
+        || dram_image_table_checksum(header, table) != header.checksum) {
+        error = path + " has a damaged header";
+        close(fd);
+        return false;
+    }
+
+    dram_image_header expected;
+    dram_image_fill_params(expected);
+    if (header.test_images != expected.test_images || header.num_layers != expected.num_layers
+        || memcmp(header.layer_sizes, expected.layer_sizes, sizeof(header.layer_sizes)) != 0) {
+        error = path + " was built for another network or test set size";
+        close(fd);
+        return false;
+    }
+
+    size_t payload_bytes = (size_t) header.payload_words * sizeof(unsigned int);
+    if (header.payload_words > capacity || header.payload_offset % DRAM_IMAGE_ALIGN != 0
+        || header.payload_offset + payload_bytes > (uint64_t) st.st_size) {
+        error = path + " is truncated or does not fit the DRAM";
+        close(fd);
+        return false;
+    }
+    for (unsigned int i = 0; i < table.size(); i++) {
+        if ((uint64_t) table[i].offset + table[i].words > header.payload_words) {
+            error = path + " has a region outside its payload";
+            close(fd);
+            return false;
+        }
+    }
+    if (!dram_image_check_lengths(table, error)) {
+        error = path + ": " + error;
+        close(fd);
+        return false;
+    }
+
+    bool mapped = false;
+    if (payload_bytes > 0 && header.payload_offset % sysconf(_SC_PAGESIZE) == 0) {
+        // the whole pages of the payload, the file is padded so the last one is complete
+        size_t map_bytes = (payload_bytes + sysconf(_SC_PAGESIZE) - 1) / sysconf(_SC_PAGESIZE) * sysconf(_SC_PAGESIZE);
+        if (header.payload_offset + map_bytes <= (uint64_t) st.st_size && map_bytes <= (size_t) capacity * sizeof(unsigned int)) {
+            mapped = mmap(mem, map_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t) header.payload_offset) != MAP_FAILED;
+        }
+    }
+    if (!mapped && payload_bytes > 0 && pread(fd, mem, payload_bytes, (off_t) header.payload_offset) != (ssize_t) payload_bytes) {
+        error = "cannot read " + path;
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    regions.clear();
+    for (unsigned int i = 0; i < table.size(); i++) {
+        dram_region r;
+        r.name = std::string(table[i].name, strnlen(table[i].name, DRAM_IMAGE_NAME_LEN));
+        r.offset = table[i].offset;
+        r.words = table[i].words;
+        if (dram_image_words_checksum(mem + r.offset, r.words) != table[i].checksum) {
+            error = path + ": checksum mismatch in region " + r.name;
+            return false;
+        }
+        regions.push_back(r);
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+/*************************************************************
+DRAM_Image_Convert.cpp builds the binary DRAM preload image
+(see dram_image.h) from the text weights in Weights/ and the
+MNIST test set in MNIST/, read from the working directory
+exactly as the DRAM model reads them. Pass the image to
+Proj_exec with -i to skip the parsing at startup.
+
+The image records TEST_IMAGES and LAYER_SIZES, rebuild it
+whenever they change.
+
+With -z the weights are packed (see weight_codec.h) into a
+codebook of shared weights and run-length coded indices,
+about a quarter of the dense words or less with pruning.
+-z <threshold> also zeroes every weight smaller in magnitude
+than threshold first. The simulator recognises a packed
+image by its weight_dir region.
+
+Usage: ./dram_image_convert [-z [threshold]] <image>
+*************************************************************/
+
+#include <systemc.h>
+#include <sys/mman.h>
+#include <project_include.h>
+#include "dram_image.h"
+
+int sc_main(int argc, char *argv[]) {
+	bool pack = false;
+	float prune = 0;
+	int arg = 1;
+	if (arg < argc && std::string(argv[arg]) == "-z") {
+		pack = true;
+		arg++;
+		if (arg + 1 < argc) {
+			prune = (float) atof(argv[arg++]);
+		}
+	}
+	if (arg + 1 != argc || argv[arg][0] == '-' || prune < 0) {
+		cout << "Usage: ./dram_image_convert [-z [threshold]] <image>" << endl;
+		return 1;
+	}
+	const char *path = argv[arg];
+	//the layer sizes and packing of the preload are the converter's report
+	sim_log::level() = LOG_LEVEL_INFO;
+
+	void *store = mmap(NULL, (size_t) DRAM_SIZE * sizeof(unsigned int), PROT_READ | PROT_WRITE,
+	                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (store == MAP_FAILED) {
+		cout << "ERROR: CANNOT RESERVE " << DRAM_SIZE << " WORDS" << endl;
+		return 1;
+	}
+	unsigned int *mem = (unsigned int *) store;
+
+	std::vector<dram_region> regions;
+	std::string error;
+	if (!preload_weights(mem, DRAM_SIZE, regions, error)) {
+		cout << "ERROR: " << error << endl;
+		return 1;
+	}
+	if (pack) {
+		regions = pack_weights(mem, regions, prune);
+	}
+	regions.push_back(preload_test_set(mem, regions.back().offset + regions.back().words));
+	unsigned int payload_words = regions.back().offset + regions.back().words;
+
+	if (!write_dram_image(path, mem, payload_words, regions, error)) {
+		cout << "ERROR: " << error << endl;
+		return 1;
+	}
+	for (unsigned int i = 0; i < regions.size(); i++) {
+		cout << regions[i].name << ": offset " << regions[i].offset << ", " << regions[i].words << " words" << endl;
+	}
+	cout << "Wrote " << path << ": " << payload_words << " words in " << regions.size() << " regions" << endl;
+
+	munmap(store, (size_t) DRAM_SIZE * sizeof(unsigned int));
+	return 0;
+}
@@ -0,0 +1,380 @@
+#pragma once
+
+/*************************************************************
+DRAM_Preload.h fills the DRAM backing store with the network
+weights and the test set from their source files. It is used
+by the DRAM model when no binary image is given and by
+dram_image_convert to build one, so both produce the same
+memory contents.
+
+LAYOUT (word offsets from DRAM_BASE_ADDR):
+	The weights of layer 0 to NUM_LAYERS - 1, one after the
+	other, as read from Weights/weight_l<i>.txt, whitespace-
+	separated floats, LAYER_SIZES[i] * LAYER_SIZES[i + 1] of
+	them per layer. Then
+	TEST_IMAGES test images from MNIST/, each 28 * 28 pixels
+	scaled to [-1, 1] as floats and followed by its label as
+	an integer word, then the same labels once more as a
+	contiguous array of TEST_IMAGES bytes packed
+	EIE_RESULTS_PER_WORD to a word (preload_test_labels), so
+	a batch of them is one short burst.
+	When the test set is streamed instead (dataset_loader.h)
+	the images pass through a ring of slots in the same
+	layout at the same place.
+
+	pack_weights() turns this into the packed layout of
+	weight_codec.h, a directory and the packed layers, and
+	the test set then follows the packed layers.
+*************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <project_include.h>
+#include "weight_codec.h"
+#include "sim_log.h"
+
+using namespace std;
+
+//Words of a test image in DRAM, its pixels and its label
+#define MNIST_IMAGE_WORDS (28 * 28 + 1)
+
+//Bytes of weight text parsed per task
+#ifndef PRELOAD_CHUNK_BYTES
+#define PRELOAD_CHUNK_BYTES (1 << 20)
+#endif
+
+// a named block of preloaded words, offsets are from DRAM_BASE_ADDR
+struct dram_region {
+    std::string name;
+    unsigned int offset;
+    unsigned int words;
+};
+
+// one file's share of the weight parsing, split on a whitespace boundary
+struct weight_chunk {
+    unsigned int layer;
+    const char *begin;
+    const char *end;
+    unsigned int count;  // values in the chunk, from the counting pass
+    unsigned int offset; // word offset of its first value in the DRAM
+    unsigned int errors; // tokens that are not floats
+};
+
+inline bool weight_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+// run fn(0) .. fn(n - 1) on up to threads worker threads
+template <typename FN>
+void parallel_for(unsigned int n, unsigned int threads, FN fn) {
+    std::atomic<unsigned int> next(0);
+    std::vector<std::thread> pool;
+    for (unsigned int t = 0; t < std::min(threads, n); t++) {
+        pool.push_back(std::thread([&]() {
+            for (unsigned int i = next++; i < n; i = next++) {
+                fn(i);
+            }
+        }));
+    }
+    for (unsigned int t = 0; t < pool.size(); t++) {
+        pool[t].join();
+    }
+}
+
+/*
+Parse the text weights of every layer into mem from offset 0, one region per layer. Each
+file is mapped and cut into PRELOAD_CHUNK_BYTES chunks on whitespace boundaries, a first
+parallel pass counts the values in every chunk, which places each chunk in the DRAM, and
+a second one parses them with std::from_chars straight to their place. mem holds capacity
+words. A layer whose value count differs from LAYER_SIZES, or weights that do not fit mem,
+fail the preload before anything is written and error says why.
+*/
+inline bool preload_weights(unsigned int *mem, unsigned int capacity, std::vector<dram_region> &regions, std::string &error) {
+    regions.clear();
+    unsigned int layersizes[NUM_LAYERS + 1] = LAYER_SIZES;
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<weight_chunk> chunks;
+    std::vector<std::pair<void *, size_t> > maps;
+    for (int i = 0; i < NUM_LAYERS; i++) {
+        std::string path("Weights/");
+        path += std::string("weight_l") + std::to_string(i) + std::string(".txt");
+        LOG_INFO(LOG_DRAM, "loading " << path);
+
+        const char *text = NULL;
+        size_t size = 0;
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            LOG_ERROR(LOG_DRAM, "CANNOT OPEN " << path);
+        } else if (st.st_size > 0) {
+            size = (size_t) st.st_size;
+            void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m == MAP_FAILED) {
+                LOG_ERROR(LOG_DRAM, "CANNOT MAP " << path);
+                size = 0;
+            } else {
+                madvise(m, size, MADV_SEQUENTIAL);
+                maps.push_back(std::make_pair(m, size));
+                text = (const char *) m;
+            }
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        // cut after the whitespace that follows every PRELOAD_CHUNK_BYTES
+        const char *end = text + size;
+        const char *begin = text;
+        while (begin < end) {
+            const char *cut = begin + std::min((size_t) PRELOAD_CHUNK_BYTES, (size_t) (end - begin));
+            while (cut < end && !weight_space(*cut)) {
+                cut++;
+            }
+            weight_chunk c;
+            c.layer = i;
+            c.begin = begin;
+            c.end = cut;
+            c.count = 0;
+            c.offset = 0;
+            c.errors = 0;
+            chunks.push_back(c);
+            begin = cut;
+        }
+    }
+
+    // pass 1: count the values of every chunk
+    parallel_for((unsigned int) chunks.size(), threads, [&](unsigned int k) {
+        weight_chunk &c = chunks[k];
+        bool in_token = false;
+        for (const char *p = c.begin; p < c.end; p++) {
+            bool space = weight_space(*p);
+            c.count += (!space && !in_token) ? 1 : 0;
+            in_token = !space;
+        }
+    });
+
+    std::vector<unsigned int> counts(NUM_LAYERS, 0);
+    unsigned long long base_addr = 0;
+    for (unsigned int k = 0; k < chunks.size(); k++) {
+        counts[chunks[k].layer] += chunks[k].count;
+    }
+    std::vector<unsigned int> layer_base(NUM_LAYERS, 0);
+    for (int i = 0; i < NUM_LAYERS; i++) {
+        if (counts[i] != layersizes[i] * layersizes[i + 1]) {
+            error = "weight layer " + std::to_string(i) + " has " + std::to_string(counts[i]) + " values, LAYER_SIZES expects "
+                    + std::to_string(layersizes[i] * layersizes[i + 1]);
+        }
+        layer_base[i] = (unsigned int) base_addr;
+        base_addr += counts[i];
+    }
+    if (error.empty() && base_addr > capacity) {
+        error = "the weights need " + std::to_string(base_addr) + " words, the DRAM holds " + std::to_string(capacity);
+    }
+    if (!error.empty()) {
+        for (unsigned int k = 0; k < maps.size(); k++) {
+            munmap(maps[k].first, maps[k].second);
+        }
+        return false;
+    }
+    std::vector<unsigned int> filled(layer_base);
+    for (unsigned int k = 0; k < chunks.size(); k++) {
+        chunks[k].offset = filled[chunks[k].layer];
+        filled[chunks[k].layer] += chunks[k].count;
+    }
+
+    // pass 2: parse every chunk into its place
+    parallel_for((unsigned int) chunks.size(), threads, [&](unsigned int k) {
+        weight_chunk &c = chunks[k];
+        unsigned int *out = mem + c.offset;
+        const char *p = c.begin;
+        for (unsigned int n = 0; n < c.count; n++) {
+            while (weight_space(*p)) {
+                p++;
+            }
+            const char *token = p;
+            while (p < c.end && !weight_space(*p)) {
+                p++;
+            }
+            float f = 0;
+            const char *first = (*token == '+') ? token + 1 : token;
+            std::from_chars_result r = std::from_chars(first, p, f);
+            if (r.ec != std::errc() || r.ptr != p) {
+                c.errors++;
+            }
+            memcpy(&out[n], &f, sizeof(f));
+        }
+    });
+
+    for (unsigned int k = 0; k < maps.size(); k++) {
+        munmap(maps[k].first, maps[k].second);
+    }
+
+    for (int i = 0; i < NUM_LAYERS; i++) {
+        unsigned int errors = 0;
+        for (unsigned int k = 0; k < chunks.size(); k++) {
+            errors += (chunks[k].layer == (unsigned int) i) ? chunks[k].errors : 0;
+        }
+        LOG_INFO(LOG_DRAM, "weight layer " << i << " size = " << counts[i]);
+        if (errors > 0) {
+            LOG_ERROR(LOG_DRAM, "WEIGHT LAYER " << i << " HAS " << errors << " VALUES THAT ARE NOT FLOATS");
+        }
+
+        for (int j = 0; j < NUM_ACCELERATORS && counts[i] >= (j + 1) * layersizes[i]; j++) {
+            LOG_DEBUG(LOG_DRAM, "weight layer " << i << " row " << j << ": " << *(float *) &mem[layer_base[i] + j * layersizes[i]] << " "
+                      << *(float *) &mem[layer_base[i] + j * layersizes[i] + 1] << " " << *(float *) &mem[layer_base[i] + j * layersizes[i] + 2]);
+        }
+
+        dram_region r;
+        r.name = std::string("weight_l") + std::to_string(i);
+        r.offset = layer_base[i];
+        r.words = counts[i];
+        regions.push_back(r);
+    }
+    return true;
+}
+
+/*
+Replace the dense layers preloaded by preload_weights with the directory and the packed
+layers of weight_codec.h, from offset 0, and return their regions, the directory first.
+The layers are packed in parallel. The test set goes at the last region's end.
+*/
+inline std::vector<dram_region> pack_weights(unsigned int *mem, const std::vector<dram_region> &dense, float prune) {
+    std::vector<std::vector<unsigned int> > packed(dense.size());
+    parallel_for((unsigned int) dense.size(), std::max(1u, std::thread::hardware_concurrency()), [&](unsigned int i) {
+        pack_layer((const float *) (mem + dense[i].offset), dense[i].words, prune, packed[i]);
+    });
+
+    std::vector<dram_region> regions;
+    dram_region dir;
+    dir.name = "weight_dir";
+    dir.offset = 0;
+    dir.words = WEIGHT_DIR_WORDS;
+    regions.push_back(dir);
+
+    unsigned int base_addr = WEIGHT_DIR_WORDS;
+    std::vector<unsigned int> directory(WEIGHT_DIR_WORDS, 0);
+    for (unsigned int i = 0; i < packed.size(); i++) {
+        dram_region r;
+        r.name = dense[i].name;
+        r.offset = base_addr;
+        r.words = (unsigned int) packed[i].size();
+        regions.push_back(r);
+        directory[2 * i] = r.offset;
+        directory[2 * i + 1] = r.words;
+        base_addr += r.words;
+        LOG_INFO(LOG_DRAM, r.name << " packed " << dense[i].words << " -> " << r.words << " words");
+    }
+    directory[2 * NUM_LAYERS] = base_addr;
+
+    memcpy(mem, directory.data(), WEIGHT_DIR_WORDS * sizeof(unsigned int));
+    for (unsigned int i = 0; i < packed.size(); i++) {
+        memcpy(mem + regions[i + 1].offset, packed[i].data(), packed[i].size() * sizeof(unsigned int));
+    }
+    unsigned int dense_end = dense.empty() ? 0 : dense.back().offset + dense.back().words;
+    if (dense_end > base_addr) {
+        memset(mem + base_addr, 0, (size_t) (dense_end - base_addr) * sizeof(unsigned int));
+    }
+    return regions;
+}
+
+// n bytes as space-separated hex pairs
+inline std::string hex_bytes(const unsigned char *bytes, unsigned int n) {
+    std::ostringstream out;
+    for (unsigned int i = 0; i < n; i++) {
+        out << (i > 0 ? " " : "") << std::setfill('0') << std::setw(2) << hex << (unsigned int) bytes[i];
+    }
+    return out.str();
+}
+
+// sequential reader of the MNIST test set, one image and its label at a time
+struct mnist_reader {
+    ifstream imgs, labels;
+    unsigned int images; // in the files, from their headers
+
+    // open the test set and skip to image first, false if it is missing or has fewer images
+    bool open(unsigned int first) {
+        imgs.open("MNIST/t10k-images.idx3-ubyte", ios::in | ios::binary);
+        labels.open("MNIST/t10k-labels.idx1-ubyte", ios::in | ios::binary);
+
+        unsigned char imghead[16];
+        unsigned char labelhead[8];
+        memset(imghead, 0, sizeof(imghead));
+        memset(labelhead, 0, sizeof(labelhead));
+        imgs.read((char *) imghead, 16);
+        labels.read((char *) labelhead, 8);
+        LOG_DEBUG(LOG_DRAM, "MNIST image header " << hex_bytes(imghead, 16) << ", label header " << hex_bytes(labelhead, 8));
+
+        // big-endian counts, the smaller of the two files decides
+        unsigned int img_count = (imghead[4] << 24) | (imghead[5] << 16) | (imghead[6] << 8) | imghead[7];
+        unsigned int label_count = (labelhead[4] << 24) | (labelhead[5] << 16) | (labelhead[6] << 8) | labelhead[7];
+        images = (imgs && labels) ? std::min(img_count, label_count) : 0;
+        if (first >= images) {
+            return false;
+        }
+        imgs.seekg(16 + (std::streamoff) first * 28 * 28);
+        labels.seekg(8 + (std::streamoff) first);
+        return true;
+    }
+
+    // the next image as 28 * 28 pixels scaled to [-1, 1] and its label, MNIST_IMAGE_WORDS words
+    bool next(unsigned int *words) {
+        unsigned char imgbuf[28 * 28];
+        unsigned char label = 0;
+        imgs.read((char *) imgbuf, 28 * 28);
+        labels.read((char *) &label, 1);
+        for (int j = 0; j < 28 * 28; j++) {
+            float dimg = (float) imgbuf[j];
+            dimg = dimg * 2.0f / 255.0f - 1.0f;
+            memcpy(&words[j], &dimg, sizeof(dimg));
+        }
+        words[28 * 28] = label;
+        return (bool) imgs && (bool) labels;
+    }
+};
+
+// read TEST_IMAGES images and their labels into mem from base_addr on
+inline dram_region preload_test_set(unsigned int *mem, unsigned int base_addr) {
+    dram_region r;
+    r.name = "test_set";
+    r.offset = base_addr;
+
+    mnist_reader reader;
+    if (!reader.open(0) || reader.images < TEST_IMAGES) {
+        LOG_ERROR(LOG_DRAM, "MNIST/ HOLDS " << reader.images << " TEST IMAGES, TEST_IMAGES IS " << TEST_IMAGES);
+    }
+    for (unsigned int i = 0; i < TEST_IMAGES; i++) {
+        reader.next(&mem[base_addr]);
+        base_addr += MNIST_IMAGE_WORDS;
+    }
+
+    r.words = base_addr - r.offset;
+    return r;
+}
+
+// copy the labels of the images of test_set into a contiguous array of bytes right after it
+inline dram_region preload_test_labels(unsigned int *mem, const dram_region &test_set) {
+    dram_region r;
+    unsigned int images = test_set.words / MNIST_IMAGE_WORDS;
+    r.name = "test_labels";
+    r.offset = test_set.offset + test_set.words;
+    r.words = (images + EIE_RESULTS_PER_WORD - 1) / EIE_RESULTS_PER_WORD;
+    memset(&mem[r.offset], 0, r.words * sizeof(unsigned int));
+    for (unsigned int i = 0; i < images; i++) {
+        unsigned int label = mem[test_set.offset + i * MNIST_IMAGE_WORDS + 28 * 28] & 0xff;
+        mem[r.offset + i / EIE_RESULTS_PER_WORD] |= label << (8 * (i % EIE_RESULTS_PER_WORD));
+    }
+    return r;
+}
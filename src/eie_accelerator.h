@@ -4,6 +4,7 @@
 
 #include "eie_if.h"
 #include "eie_central_control.h"
+#include "sim_log.h"
 
 /*************************************************************
 EIE_Accelerator.h is the modelled EIE accelerator unit. Since
@@ -26,6 +27,13 @@ POWER MODELLING:
 		- 32-bit int multiply = 3.1 pJ
 		- 32-bit float multiply = 3.7 pJ
 
+LOOSELY-TIMED MODEL:
+	With loosely_timed set the accelerator does not follow the
+	clock. It sleeps until PushInputs() hands it a layer and
+	then waits once for all the cycles the layer would take
+	(one cycle per 10 weights of a row, as in the clocked
+	model) before publishing the output.
+
 *************************************************************/
 
 
@@ -37,8 +45,13 @@ private:
 
     bool input_ready, output_ready;
     unsigned int current_layer;
+
+    sc_event input_event, output_event;
 public:
     sc_in_clk clk;
+
+    // wait on events and one timed wait per layer instead of every clock edge
+    bool loosely_timed;
 	
 	unsigned int tally_sram_access, tally_float_add, tally_float_multiply;
 	
@@ -47,6 +60,7 @@ public:
     EIE_accelerator(sc_module_name name) : sc_module(name) {
         input_ready = false;
         output_ready = false;
+        loosely_timed = false;
 		
 		tally_sram_access = 0;
 		tally_float_add = 0;
@@ -57,25 +71,36 @@ public:
 
     void eie_accelerator_proc() {
         while (true) {
-            wait(clk.posedge_event());
+            if (loosely_timed) {
+                while (!input_ready) {
+                    wait(input_event);
+                }
+            } else {
+                wait(clk.posedge_event());
+            }
 
             if (input_ready) {
                 input_ready = false;
                 
                 output.clear();
                 if (current_layer >= weightSRAM.size()) {
-                    output_ready = true;
+                    publish_output();
                     continue;
                 }
                 std::vector<std::vector<double>> &layerWeights = weightSRAM.at(current_layer);
                 if (layerWeights.at(0).size() != input.size()) {
-                    output_ready = true;
+                    publish_output();
                     continue;
                 }
                 
+                unsigned int layer_cycles = 0;
                 for (int i = 0; i < layerWeights.size(); i++) {
-                    for (int j = 0; j < layerWeights.at(i).size() / 10; j++) {
-                        wait(clk.posedge_event());
+                    if (loosely_timed) {
+                        layer_cycles += (unsigned int) layerWeights.at(i).size() / 10;
+                    } else {
+                        for (int j = 0; j < layerWeights.at(i).size() / 10; j++) {
+                            wait(clk.posedge_event());
+                        }
                     }
                     double matVecProd = 0.0;
                     for (int j = 0; j < layerWeights.at(i).size(); j++) {
@@ -93,12 +118,20 @@ public:
                     output.push_back(std::max(0.0, matVecProd));
                 }
 				
-                output_ready = true;
+                if (loosely_timed) {
+                    wait(sc_time(INT_CLK_PERIOD_NS, SC_NS) * (double) layer_cycles);
+                }
+                publish_output();
             }
             
         }
     }
 
+    void publish_output() {
+        output_ready = true;
+        output_event.notify();
+    }
+
     bool PushWeights(std::vector<double> &weights, unsigned int layer) {
         std::vector<double> weightCopy(weights);
         while (weightSRAM.size() < layer + 1) {
@@ -119,6 +152,7 @@ public:
         current_layer = layer;
         
         input_ready = true;
+        input_event.notify();
         return true;
     }
 
@@ -126,7 +160,11 @@ public:
         result.clear();
         
         while (!output_ready) {
-            wait(clk.posedge_event());
+            if (loosely_timed) {
+                wait(output_event);
+            } else {
+                wait(clk.posedge_event());
+            }
         }
         
         for (int i = 0; i < output.size(); i++) {
@@ -136,13 +174,11 @@ public:
     }
 
     void PrintAcceleratorInfo(int accelerator_id) {
-        cout << "Accelerator " << accelerator_id << endl;
-        cout << weightSRAM.size() << " Layers:" << endl;
+        LOG_DEBUG(LOG_ACC, "accelerator " << accelerator_id << ": " << weightSRAM.size() << " layers");
         for (int i = 0; i < weightSRAM.size(); i++) {
-            cout << "Layer " << i << " - " << weightSRAM.at(i).size() << " rows, ";
-            cout << weightSRAM.at(i).at(0).size() << " columns" << endl;
-            cout << "First few weights: " << weightSRAM[i][0][0] << " " << weightSRAM[i][0][1] << " " << weightSRAM[i][0][2] << endl;
+            LOG_DEBUG(LOG_ACC, "accelerator " << accelerator_id << " layer " << i << ": " << weightSRAM.at(i).size() << " rows, "
+                      << weightSRAM.at(i).at(0).size() << " columns, first weights "
+                      << weightSRAM[i][0][0] << " " << weightSRAM[i][0][1] << " " << weightSRAM[i][0][2]);
         }
-        cout << endl;
     }
 };
@@ -1,9 +1,16 @@
 #pragma once 
 
 #include <systemc.h>
+#include <tlm.h>
+#include <tlm_utils/simple_initiator_socket.h>
+#include <tlm_utils/simple_target_socket.h>
+#include <tlm_utils/tlm_quantumkeeper.h>
 
 #include "project_include.h"
 #include "eie_if.h"
+#include "tlm_bus.h"
+#include "weight_codec.h"
+#include "sim_log.h"
 
 /*************************************************************
 EIE_Central_Control.h is the accelerator control unit. This
@@ -21,6 +28,41 @@ POWER MODELLING:
 	also take into account the power due to register writes
 	when taking the output from the accelerators. 
 	
+PACKED WEIGHTS:
+	An EIE_CC_OP_WRITE_WEIGHT with a non-zero EIE_CC_ADDR_LEN
+	reads that many words of packed layer (weight_codec.h)
+	instead of rows * rowlen dense floats and unpacks them on
+	the way to the accelerators. The decoder is taken to keep
+	up with the DMA, so it adds no time, and every entry it
+	decodes is a codebook lookup tallied for its energy.
+
+TENANTS:
+	Several CPU/control unit pairs can share the bus and the
+	DRAM, each control unit with its own accelerators. Every
+	one has its status registers at its own base_addr and
+	its DMA on its own bus master, master_id.
+
+RESULTS ARRAY:
+	An EIE_CC_OP_WRITE_INPUT with EIE_CC_ADDR_RESULTS set
+	also keeps the predicted label of the image in
+	resultBuffer, one byte each packed EIE_RESULTS_PER_WORD
+	to a word, and raises EIE_CC_ADDR_OUTREADY as usual with
+	no DRAM access of its own. EIE_CC_OP_WRITE_RESULTS
+	writes the labels kept so far as one burst to
+	EIE_CC_ADDR_DATA and sets EIE_CC_ADDR_OP_COMPLETE, so
+	the results of a whole batch of images cost one short DMA
+	write outside the images' critical path.
+
+LOOSELY-TIMED MODEL:
+	With tlm_bus the bus ports stay unbound. The status
+	registers are served on minion_socket and the DMA goes out
+	on master_socket, each transfer as a single b_transport.
+	The DMA thread keeps its own quantum and synchronises
+	before it publishes a result in the status registers.
+	With use_dmi set, DRAM reads are copied straight out of
+	the DRAM backing store through a DMI pointer and then
+	charged in bulk with one TLM_IGNORE_COMMAND transaction,
+	so time and energy are the same as for b_transport.
 
 
 *************************************************************/
@@ -35,27 +77,83 @@ private:
 
     unsigned int numLayers;
 
+    // keep the predicted label of the image in flight, and the labels kept since the last EIE_CC_OP_WRITE_RESULTS
+    bool collect_result;
+    std::vector<unsigned int> resultBuffer;
+    unsigned int resultCount;
+
     std::vector<double> inputBuffer;
     std::vector<double> outputBuffer;
+
+    // raw words of the current bus burst
+    std::vector<unsigned int> burstBuffer;
+
+    // tags of the split reads in flight, max_outstanding of them
+    std::vector<unsigned int> split_tags;
+
+    // weights of the current layer unpacked from burstBuffer
+    std::vector<float> unpackBuffer;
+
+    // DMI region granted through master_socket
+    tlm::tlm_dmi dmi;
+    bool dmi_valid;
 public:
     sc_in_clk clk;
 
     sc_port<EIE_accel_if> accelerators[NUM_ACCELERATORS];
-    sc_port<bus_minion_if> bus_minion;
-    sc_port<bus_master_if> bus_master;
+    sc_port<bus_minion_if, 1, SC_ZERO_OR_MORE_BOUND> bus_minion;
+    sc_port<bus_master_if, 1, SC_ZERO_OR_MORE_BOUND> bus_master;
+    unsigned int minion_id; // from bus_clocked::attach_minion
+
+    // status registers at [base_addr, base_addr + EIE_CC_ADDR_SIZE) and the DMA's bus master ID
+    unsigned int base_addr, master_id;
+
+    // loosely-timed alternative to the two bus ports
+    tlm_utils::simple_target_socket_optional<EIE_central_control> minion_socket;
+    tlm_utils::simple_initiator_socket_optional<EIE_central_control> master_socket;
+    tlm_utils::tlm_quantumkeeper qk;
+
+    // copy DRAM reads through DMI when the target grants it (loosely timed only)
+    bool use_dmi;
 	
 	unsigned int tally_transfers_acc_bus, tally_output_read;
+
+    // packed weight words read, weights unpacked from them and codebook lookups
+    unsigned long long tally_packed_words, tally_unpacked_weights, tally_codebook_lookups;
+
+    // read DRAM with tagged split transactions instead of one blocking burst
+    bool split_reads;
+    // split reads kept in flight, the outstanding limit the bus was built with
+    unsigned int max_outstanding;
 	
     SC_HAS_PROCESS(EIE_central_control);
 
-    EIE_central_control(sc_module_name name) : sc_module(name) {
+    EIE_central_control(sc_module_name name)
+        : sc_module(name)
+        , minion_socket("minion_socket")
+        , master_socket("master_socket") {
         numLayers = 0;
+        collect_result = false;
+        resultCount = 0;
+        split_reads = false;
+        max_outstanding = BUS_MAX_OUTSTANDING;
+        use_dmi = false;
+        dmi_valid = false;
+        minion_id = 0;
+        base_addr = EIE_CC_BASE_ADDR;
+        master_id = BUS_MST_HW;
         for (int i = 0; i < EIE_CC_ADDR_SIZE; i++) {
             status[i] = 0;
         }
 		
 		tally_output_read = 0;
 		tally_transfers_acc_bus = 0;
+        tally_packed_words = 0;
+        tally_unpacked_weights = 0;
+        tally_codebook_lookups = 0;
+
+        minion_socket.register_b_transport(this, &EIE_central_control::b_transport);
+        master_socket.register_invalidate_direct_mem_ptr(this, &EIE_central_control::invalidate_direct_mem_ptr);
         
         SC_THREAD(eie_cc_minion);
         SC_THREAD(eie_cc_master);
@@ -64,35 +162,57 @@ public:
 
     void eie_cc_minion() {
         unsigned int req_addr, req_op, req_len;
+        if (bus_minion.size() == 0) {
+            return; // loosely timed, see b_transport
+        }
         while (true) {
-            bus_minion->Listen(req_addr, req_op, req_len);
-            if (req_addr >= EIE_CC_BASE_ADDR && req_addr < EIE_CC_BASE_ADDR + EIE_CC_ADDR_SIZE) {
-                bus_minion->Acknowledge();
+            // the bus only wakes us for bursts that lie entirely inside our range
+            bus_minion->Listen(minion_id, req_addr, req_op, req_len);
+            bus_minion->Acknowledge();
 
-                unsigned int tmp_addr = req_addr - EIE_CC_BASE_ADDR;
+            unsigned int tmp_addr = req_addr - base_addr;
 
-                if (req_op == OP_READ) {
-                    for (unsigned int i = 0; i < req_len; i++) {
-                        bus_minion->SendReadData(status[tmp_addr + i]);
-                    }
-                } else if (req_op == OP_WRITE) {
-                    for (unsigned int i = 0; i < req_len; i++) {
-                        bus_minion->ReceiveWriteData(status[tmp_addr + i]);
-                    }
-                    // cout << "write " << req_addr << endl;
-                    status[EIE_CC_ADDR_OP_COMPLETE] = 0;
-                    if (tmp_addr == EIE_CC_ADDR_OP) {
-                        // cout << "op_receive_event notify" << endl;
-                        op_receive_event.notify();
-                    }
+            if (req_op == OP_READ) {
+                bus_minion->SendReadBurst(&status[tmp_addr], req_len);
+            } else if (req_op == OP_WRITE) {
+                bus_minion->ReceiveWriteBurst(&status[tmp_addr], req_len);
+                // cout << "write " << req_addr << endl;
+                status[EIE_CC_ADDR_OP_COMPLETE] = 0;
+                if (tmp_addr == EIE_CC_ADDR_OP) {
+                    // cout << "op_receive_event notify" << endl;
+                    op_receive_event.notify();
                 }
             }
         }
     }
 
+    // status register access from tlm_bus, same effect as the pin-level minion
+    void b_transport(tlm::tlm_generic_payload &trans, sc_time &delay) {
+        unsigned int tmp_addr = (unsigned int) trans.get_address() - base_addr;
+        unsigned int len = trans.get_data_length() / sizeof(unsigned int);
+        unsigned int *data = (unsigned int *) trans.get_data_ptr();
+        if (tmp_addr >= EIE_CC_ADDR_SIZE || len > EIE_CC_ADDR_SIZE - tmp_addr) {
+            trans.set_response_status(tlm::TLM_ADDRESS_ERROR_RESPONSE);
+            return;
+        }
+
+        if (trans.is_read()) {
+            memcpy(data, &status[tmp_addr], len * sizeof(unsigned int));
+        } else if (trans.is_write()) {
+            memcpy(&status[tmp_addr], data, len * sizeof(unsigned int));
+            status[EIE_CC_ADDR_OP_COMPLETE] = 0;
+            if (tmp_addr == EIE_CC_ADDR_OP) {
+                // the command takes effect at the initiator's local time
+                op_receive_event.notify(delay);
+            }
+        }
+        trans.set_response_status(tlm::TLM_OK_RESPONSE);
+    }
+
     void eie_cc_master() {
-        unsigned int req_addr, req_op, req_len, data;
+        unsigned int req_addr, req_len, data;
 
+        qk.reset();
         while (true) {
             wait(op_receive_event);
             
@@ -100,48 +220,76 @@ public:
             unsigned int layer = status[EIE_CC_ADDR_LAYER];
             unsigned int rowlen = status[EIE_CC_ADDR_ROWLEN];
             unsigned int rows = status[EIE_CC_ADDR_ROWS];
+            unsigned int packed_len = status[EIE_CC_ADDR_LEN];
 
             // cout << "op_receive_event caught" << endl;
 
             switch (status[EIE_CC_ADDR_OP]) {
             case EIE_CC_OP_WRITE_WEIGHT:
-                cout << "EIE_CC_OP_WRITE_WEIGHT" << endl;
                 if (layer + 1 > numLayers) {
                     numLayers = layer + 1;
                 }
                 req_addr = data_addr + DRAM_BASE_ADDR;
-                cout << "req_addr = " << req_addr << endl;
+                LOG_INFO(LOG_CC, "EIE_CC_OP_WRITE_WEIGHT layer " << layer << " from " << req_addr);
                 req_len = rows * rowlen;
-                req_op = OP_READ;
-                bus_master->Request(BUS_MST_HW, req_addr, req_op, req_len);
-                bus_master->WaitForAcknowledge(BUS_MST_HW);
+                if (packed_len > 0) {
+                    dma_read(req_addr, packed_len);
+                    unpackBuffer.resize(req_len);
+                    unsigned int lookups = unpack_layer(burstBuffer.data(), packed_len, unpackBuffer.data(), req_len);
+                    if (lookups == 0 && req_len > 0) {
+                        LOG_ERROR(LOG_CC, "PACKED LAYER " << layer << " HAS NO CODEBOOK");
+                    }
+                    tally_packed_words += packed_len;
+                    tally_unpacked_weights += req_len;
+                    tally_codebook_lookups += lookups;
+                } else {
+                    dma_read(req_addr, req_len);
+                }
                 for (unsigned int i = 0; i < rows; i++) {
                     std::vector<double> tmpWeights;
                     for (unsigned int j = 0; j < rowlen; j++) {
-                        bus_master->ReadData(data);
-                        double dval = (double) *(float *) &data;
+                        double dval;
+                        if (packed_len > 0) {
+                            dval = (double) unpackBuffer[i * rowlen + j];
+                        } else {
+                            data = burstBuffer[i * rowlen + j];
+                            dval = (double) *(float *) &data;
+                        }
                         tmpWeights.push_back(dval);
                     }
                     // cout << "pushing row " << i << " layer " << layer << endl;
                     accelerators[i % NUM_ACCELERATORS]->PushWeights(tmpWeights, layer);
                 }
+                lt_sync();
                 status[EIE_CC_ADDR_OP_COMPLETE] = 1;
                 
-                // for (int i = 0; i < NUM_ACCELERATORS; i++) {
-                //     accelerators[i]->PrintAcceleratorInfo(i);
-                // }
+                if (sim_log::enabled(LOG_LEVEL_DEBUG, LOG_ACC)) {
+                    for (int i = 0; i < NUM_ACCELERATORS; i++) {
+                        accelerators[i]->PrintAcceleratorInfo(i);
+                    }
+                }
                 break;
             case EIE_CC_OP_READ_OUTPUT:
                 req_addr = data_addr + DRAM_BASE_ADDR;
                 req_len = (unsigned int) outputBuffer.size();
-                req_op = OP_WRITE;
-                bus_master->Request(BUS_MST_HW, req_addr, req_op, req_len);
-                bus_master->WaitForAcknowledge(BUS_MST_HW);
+                burstBuffer.resize(req_len);
                 for (unsigned int i = 0; i < req_len; i++) {
                     float fd = (float) outputBuffer.at(i);
-                    unsigned int ud = *(unsigned int *) &fd;
-                    bus_master->WriteData(ud);
+                    burstBuffer[i] = *(unsigned int *) &fd;
+                }
+                dma_write(req_addr, burstBuffer.data(), req_len);
+                lt_sync();
+                break;
+            case EIE_CC_OP_WRITE_RESULTS:
+                req_addr = data_addr + DRAM_BASE_ADDR;
+                LOG_INFO(LOG_CC, "EIE_CC_OP_WRITE_RESULTS " << resultCount << " labels to " << req_addr);
+                if (!resultBuffer.empty()) {
+                    dma_write(req_addr, resultBuffer.data(), (unsigned int) resultBuffer.size());
                 }
+                resultBuffer.clear();
+                resultCount = 0;
+                lt_sync();
+                status[EIE_CC_ADDR_OP_COMPLETE] = 1;
                 break;
             case EIE_CC_OP_WRITE_INPUT:
                 // cout << "EIE_CC_OP_WRITE_INPUT" << endl;
@@ -149,23 +297,121 @@ public:
                 //     accelerators[i]->PrintAcceleratorInfo(i);
                 // }
                 status[EIE_CC_ADDR_OUTREADY] = 0;
+                collect_result = status[EIE_CC_ADDR_RESULTS] != 0;
                 req_addr = data_addr + DRAM_BASE_ADDR;
                 req_len = rowlen;
-                req_op = OP_READ;
-                bus_master->Request(BUS_MST_HW, req_addr, req_op, req_len);
-                bus_master->WaitForAcknowledge(BUS_MST_HW);
                 inputBuffer.clear();
+                dma_read(req_addr, req_len);
                 for (unsigned int i = 0; i < req_len; i++) {
-                    bus_master->ReadData(data);
+                    data = burstBuffer[i];
                     double dval = (double) *(float *) &data;
                     inputBuffer.push_back(dval);
                 }
+                lt_sync();
                 network_execute_event.notify();
                 break;
             }
         }
     }
 
+    /*
+    Read len words starting at bus address addr into burstBuffer. With split reads the
+    transfer is cut into SPLIT_READ_CHUNK word reads and up to max_outstanding of
+    them are kept in flight, otherwise it is a single blocking burst (a single
+    b_transport on the loosely-timed bus). A read the bus drops stops the run.
+    */
+    void dma_read(unsigned int addr, unsigned int len) {
+        burstBuffer.resize(len);
+        bool ok = true;
+        if (master_socket.size() > 0) {
+            if (!use_dmi || !dmi_read(addr, len)) {
+                ok = lt_transport(master_socket, qk, tlm::TLM_READ_COMMAND, addr, burstBuffer.data(), len);
+            }
+        } else if (!split_reads) {
+            bus_master->Request(master_id, addr, OP_READ, len);
+            ok = bus_master->WaitForAcknowledge(master_id);
+            if (ok) {
+                bus_master->ReadBurst(burstBuffer.data(), len);
+            }
+        } else {
+            unsigned int chunk = SPLIT_READ_CHUNK;
+            unsigned int chunks = (len + chunk - 1) / chunk;
+            unsigned int in_flight = std::max(1u, max_outstanding);
+            split_tags.resize(in_flight);
+            unsigned int issued = 0, collected = 0;
+            while (collected < chunks) {
+                while (issued < chunks && issued - collected < in_flight) {
+                    unsigned int offset = issued * chunk;
+                    split_tags[issued % in_flight] = bus_master->RequestRead(master_id, addr + offset, std::min(chunk, len - offset));
+                    issued++;
+                }
+                unsigned int offset = collected * chunk;
+                // every tag is collected to free it, a dropped one fails the whole read
+                ok = bus_master->ReadResponse(split_tags[collected % in_flight], &burstBuffer[offset], std::min(chunk, len - offset)) && ok;
+                collected++;
+            }
+        }
+        if (!ok) {
+            dma_failed("read", addr, len);
+        }
+    }
+
+    // write len words from data to bus address addr as a single burst, a dropped write stops the run
+    void dma_write(unsigned int addr, unsigned int *data, unsigned int len) {
+        bool ok;
+        if (master_socket.size() > 0) {
+            ok = lt_transport(master_socket, qk, tlm::TLM_WRITE_COMMAND, addr, data, len);
+        } else {
+            bus_master->Request(master_id, addr, OP_WRITE, len);
+            ok = bus_master->WaitForAcknowledge(master_id);
+            if (ok) {
+                bus_master->WriteBurst(data, len);
+            }
+        }
+        if (!ok) {
+            dma_failed("write", addr, len);
+        }
+    }
+
+    void dma_failed(const char *op, unsigned int addr, unsigned int len) {
+        std::ostringstream msg;
+        msg << "DMA " << op << " of " << len << " words at " << addr << " failed";
+        SC_REPORT_ERROR(name(), msg.str().c_str());
+    }
+
+    // copy len words at addr out of the DMI region, false if DMI does not cover them
+    bool dmi_read(unsigned int addr, unsigned int len) {
+        if (!dmi_valid || addr < dmi.get_start_address() || (sc_dt::uint64) addr + len - 1 > dmi.get_end_address()) {
+            tlm::tlm_generic_payload trans;
+            trans.set_command(tlm::TLM_READ_COMMAND);
+            trans.set_address(addr);
+            dmi.init();
+            dmi_valid = master_socket->get_direct_mem_ptr(trans, dmi) && dmi.is_read_allowed();
+            if (!dmi_valid || addr < dmi.get_start_address() || (sc_dt::uint64) addr + len - 1 > dmi.get_end_address()) {
+                return false;
+            }
+        }
+
+        const unsigned int *store = (const unsigned int *) dmi.get_dmi_ptr();
+        memcpy(burstBuffer.data(), store + (addr - dmi.get_start_address()), len * sizeof(unsigned int));
+
+        // charge the bus and the DRAM for the burst without moving the data again
+        return lt_transport(master_socket, qk, tlm::TLM_IGNORE_COMMAND, addr, NULL, len);
+    }
+
+    void invalidate_direct_mem_ptr(sc_dt::uint64 start, sc_dt::uint64 end) {
+        if (start <= dmi.get_end_address() && end >= dmi.get_start_address()) {
+            dmi_valid = false;
+        }
+    }
+
+    // catch up with simulation time before other modules can see what the DMA did
+    void lt_sync() {
+        if (master_socket.size() > 0) {
+            qk.sync();
+        }
+    }
+
     void network_execute() {
         while (true) {
             wait(network_execute_event);
@@ -218,6 +464,13 @@ public:
                 }
             }
             status[EIE_CC_ADDR_PREDICTED_LABEL] = maxidx;
+            if (collect_result) {
+                if (resultCount % EIE_RESULTS_PER_WORD == 0) {
+                    resultBuffer.push_back(0);
+                }
+                resultBuffer.back() |= maxidx << (8 * (resultCount % EIE_RESULTS_PER_WORD));
+                resultCount++;
+            }
             status[EIE_CC_ADDR_OUTREADY] = 1;
         }
     }
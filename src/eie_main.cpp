@@ -8,21 +8,42 @@ accelerators themselves (eie_accelerator), an internal-to-
 external bus module (cross_bus_module), and finally a DRAM 
 module. Power modelling is done with some approximations 
 based on the reported energy usage in the EIE paper. 
+
+TENANTS:
+	-k <tenants> builds that many CPU/control unit pairs, each
+	control unit with its own NUM_ACCELERATORS accelerators,
+	sharing the internal bus, the Cross_Bus and the DRAM. The
+	CPU of tenant k is bus master 2k and its control unit 2k+1,
+	the control unit's status registers sit EIE_CC_ADDR_SIZE
+	words above those of tenant k-1. The test images are split
+	into contiguous slices, one per tenant, and every tenant
+	loads its own copy of the weights. The weight phase ends
+	when the last tenant has its weights, and the report adds
+	each tenant's slice, accuracy and throughput.
 *************************************************************/
 
+#define SC_INCLUDE_DYNAMIC_PROCESSES //the Cross_Bus spawns one thread per DRAM channel
 #include <systemc.h>
 #include <project_include.h>
+#include <sstream>
 #include "bus.h"
+#include "bus_crossbar.h"
+#include "tlm_bus.h"
 #include "cross_bus_module.cpp"
 #include "DRAM.cpp"
 #include "eie_accelerator.h"
 #include "eie_sw_module.h"
+#include "dataset_loader.h"
+#include "sim_log.h"
 
 #define help_usage 1
 #define help_file 2
 
-#define clock_period_int 0.5
-#define clock_period_ex  20
+#define clock_period_int INT_CLK_PERIOD_NS
+#define clock_period_ex  EXT_CLK_PERIOD_NS
+
+//Default quantum of the loosely-timed model in ns
+#define TLM_QUANTUM_NS 1000
 
 //Define the power numbers - all numbers in pJ
 #define POWER_FL_ADD      0.9
@@ -34,6 +55,70 @@ based on the reported energy usage in the EIE paper.
 #define POWER_BUS         1.0
 #define POWER_REGISTER    1.0
 #define POWER_DRAM        640.0
+//Split of a DRAM access with the bank model, a closed-page word access adds up to POWER_DRAM
+#define POWER_DRAM_ACTIVATE  300.0
+#define POWER_DRAM_RW        240.0 //per word read or written, I/O included
+#define POWER_DRAM_PRECHARGE 100.0
+#define POWER_CACHE_TAG   0.5  //per way compared on a lookup
+#define POWER_CACHE_DATA  5.0  //per word read or written in the data array
+#define POWER_CODEBOOK    1.0  //per codebook lookup of the CC's weight decoder
+
+//Run-time options parsed from the command line
+struct sim_config {
+	int log_level;          //run-time log level, see sim_log.h
+	unsigned int log_categories; //categories logged, LOG_ALL by default
+	std::string results_path; //per-image results CSV, empty for none
+	unsigned int bus_width; //on-chip bus data width in bits
+	bool split_reads;       //DRAM reads as split transactions
+	std::string arbitration; //bus arbitration policy: rr, fp, wrr or tdma
+	bus_master_qos qos[2];  //QoS registers of BUS_MST_SW and BUS_MST_HW
+	bool crossbar;          //multi-layer crossbar, one bus_clocked layer per slave
+	bool loosely_timed;     //TLM-2.0 bus with temporal decoupling instead of bus_clocked
+	double quantum_ns;      //global quantum of the loosely-timed model
+	bool dmi;               //CC copies DRAM bursts through DMI (loosely timed only)
+	std::string trace_path; //binary bus transaction trace, empty for none
+	std::string image_path; //binary DRAM preload image, empty to parse the source files
+	bool cache;             //cache in the Cross_Bus in front of the DRAM
+	cache_config cache_cfg;
+	unsigned int prefetch_depth; //stream prefetcher buffer in words, 0 for none
+	unsigned int write_buffer_depth; //posted DRAM writes in words, 0 for none
+	bool dram_banks;        //DRAM bank and row-buffer timing model
+	bool open_page;         //page policy of the bank model
+	unsigned int dram_channels; //DRAM channels behind the Cross_Bus
+	bool page_interleave;   //interleave the channels by DRAM row instead of cache line
+	unsigned int first_image; //first test image streamed
+	unsigned int num_images;  //test images streamed, 0 to preload TEST_IMAGES instead
+	unsigned int results_batch; //images per results array read back by the CPU, 0 to read every result
+	unsigned int tenants;     //CPU/CC pairs sharing the bus and the DRAM
+
+	sim_config() {
+		log_level = LOG_LEVEL_WARN;
+		log_categories = LOG_ALL;
+		bus_width = BUS_DATA_WIDTH;
+		split_reads = false;
+		arbitration = "rr";
+		//the CC's DMA is latency critical, the CPU mostly polls status
+		qos[BUS_MST_SW].priority = 0;
+		qos[BUS_MST_SW].weight = 1;
+		qos[BUS_MST_HW].priority = 1;
+		qos[BUS_MST_HW].weight = 4;
+		crossbar = false;
+		loosely_timed = false;
+		quantum_ns = TLM_QUANTUM_NS;
+		dmi = false;
+		cache = false;
+		prefetch_depth = 0;
+		write_buffer_depth = 0;
+		dram_banks = false;
+		open_page = true;
+		dram_channels = 1;
+		page_interleave = false;
+		first_image = 0;
+		num_images = 0;
+		results_batch = 0;
+		tenants = 1;
+	}
+};
 
 //Top module
 class project_top : public sc_module {
@@ -49,12 +134,20 @@ class project_top : public sc_module {
 		// sc_signal<int> sw_cycles, hw_cycles;
 		
 		//Object references
-		bus_clocked * bus;
-		EIE_SW_module * eie_sw;
+		bus_clocked * bus;      //pin-level bus, NULL in the loosely-timed model
+		bus_crossbar * xbar;    //multi-layer crossbar, NULL otherwise
+		bus_trace_writer * trace; //NULL unless tracing
+		tlm_bus   * lt_bus;     //loosely-timed bus, NULL otherwise
+		EIE_SW_module * eie_sw; //first tenant's CPU
+		std::vector<EIE_SW_module *> eie_sws; //every tenant's CPU, eie_sw included
 		Cross_Bus * cross_bus;
-		DRAM      * dram;
-		EIE_central_control * eie_cc;
-		EIE_accelerator * eie_accels[NUM_ACCELERATORS];
+		DRAM      * dram;       //first channel, owns the backing store
+		std::vector<DRAM *> drams; //every channel, dram included
+		EIE_central_control * eie_cc; //first tenant's CC
+		std::vector<EIE_central_control *> eie_ccs; //every tenant's CC, eie_cc included
+		std::vector<dataset_loader *> loaders; //one per tenant, empty when the test set is preloaded
+		csv_sink results;       //per-image results, open only with -R
+		std::vector<EIE_accelerator *> eie_accels; //NUM_ACCELERATORS per tenant
 		
 		//Static and dynamic power estimates tallied from the modules
 		double power_dynamic, power_static;
@@ -62,7 +155,7 @@ class project_top : public sc_module {
 		SC_HAS_PROCESS(project_top);
 		
 		//Top module constructor
-		project_top(sc_module_name name, bool verbose) : sc_module(name) {
+		project_top(sc_module_name name, const sim_config &cfg) : sc_module(name) {
 			init_print();
 			
 			power_dynamic = 0; //sum and multiple of tallies with energy numbers.
@@ -73,83 +166,263 @@ class project_top : public sc_module {
 			 	sensitive << int_clk.pos();
 			
 			//Instantiate the objects and link them to the various ports and signals
-			bus = new bus_clocked("MY_BUS");
-			bus->clk(int_clk);
-			unsigned int idtmp;
-			bus->attach_master(idtmp);
-			bus->attach_master(idtmp);
+			//the CC keeps as many split reads in flight as the bus has request slots per master
+			unsigned int outstanding = BUS_MAX_OUTSTANDING;
+			bus = NULL;
+			xbar = NULL;
+			lt_bus = NULL;
+			if(cfg.loosely_timed){
+				tlm_utils::tlm_quantumkeeper::set_global_quantum(sc_time(cfg.quantum_ns, SC_NS));
+				lt_bus = new tlm_bus("MY_BUS", cfg.bus_width);
+			}else if(cfg.crossbar){
+				//slave k is tenant k's CC, the last slave the Cross_Bus
+				xbar = new bus_crossbar("MY_BUS", 2 * cfg.tenants, cfg.tenants + 1, 0, outstanding, cfg.bus_width);
+				xbar->clk(int_clk);
+				xbar->set_arbitration(cfg.arbitration);
+				for (unsigned int k = 0; k < cfg.tenants; k++) {
+					xbar->set_master_qos(BUS_MST_SW + 2 * k, cfg.qos[BUS_MST_SW].priority, cfg.qos[BUS_MST_SW].weight);
+					xbar->set_master_qos(BUS_MST_HW + 2 * k, cfg.qos[BUS_MST_HW].priority, cfg.qos[BUS_MST_HW].weight);
+				}
+			}else{
+				bus = new bus_clocked("MY_BUS", 0, 1, outstanding, cfg.bus_width);
+				bus->clk(int_clk);
+				unsigned int idtmp;
+				for (unsigned int k = 0; k < cfg.tenants; k++) {
+					bus->attach_master(idtmp);
+					bus->attach_master(idtmp);
+				}
+				bus->set_arbitration(make_arb_policy(cfg.arbitration));
+				for (unsigned int k = 0; k < cfg.tenants; k++) {
+					bus->set_master_qos(BUS_MST_SW + 2 * k, cfg.qos[BUS_MST_SW].priority, cfg.qos[BUS_MST_SW].weight);
+					bus->set_master_qos(BUS_MST_HW + 2 * k, cfg.qos[BUS_MST_HW].priority, cfg.qos[BUS_MST_HW].weight);
+				}
+			}
 
-            eie_sw = new EIE_SW_module("EIE_SW");
-            eie_sw -> bus(*bus);
-			
-			dram = new DRAM("MY_DRAM");
-			dram -> clk(ext_clk);
+			dram = new DRAM("MY_DRAM", cfg.image_path, NULL, cfg.num_images == 0);
+			drams.push_back(dram);
+			for (unsigned int i = 1; i < cfg.dram_channels; i++) {
+				std::string name("MY_DRAM_" + std::to_string(i));
+				drams.push_back(new DRAM(name.c_str(), "", dram));
+			}
+			//line interleaving follows the -c line size, the default line without a cache
+			unsigned int interleave = cfg.page_interleave ? DRAM_ROW_WORDS : cfg.cache_cfg.line_bytes / sizeof(unsigned int);
 			
 			cross_bus = new Cross_Bus("MY_INTERNAL_EXTERNAL_MOD");
-			cross_bus -> internal_bus(*bus);
-			cross_bus -> dram_if(*dram);
+			cross_bus -> interleave_words = interleave;
+			for (unsigned int i = 0; i < drams.size(); i++) {
+				drams[i] -> clk(ext_clk);
+				drams[i] -> set_interleave(i, (unsigned int) drams.size(), interleave);
+				if(cfg.dram_banks){
+					drams[i] -> enable_banks(cfg.open_page);
+				}
+				cross_bus -> dram_if(*drams[i]);
+			}
 			cross_bus -> internal_clk(int_clk);
 			cross_bus -> external_clk(ext_clk);
+			if(cfg.cache){
+				cross_bus -> enable_cache(cfg.cache_cfg);
+			}
+			cross_bus -> prefetch_depth = cfg.prefetch_depth;
+			cross_bus -> write_buffer_depth = cfg.write_buffer_depth;
 
-			eie_cc = new EIE_central_control("EIE_CENTRAL_CONTROL");
-            eie_cc -> clk(int_clk);
-			eie_cc -> bus_master(*bus);
-			eie_cc -> bus_minion(*bus);
-
-			for (int i = 0; i < NUM_ACCELERATORS; i++) {
-				std::string name("EIE_ACCELERATOR_" + std::to_string(i));
+			trace = NULL;
+			if(!cfg.trace_path.empty()){
+				trace = new bus_trace_writer(cfg.trace_path, clock_period_int);
+				if(lt_bus){
+					lt_bus->set_trace(trace);
+				}else if(xbar){
+					xbar->set_trace(trace);
+				}else{
+					bus->set_trace(trace);
+				}
+			}
+			
+			if(!cfg.results_path.empty()){
+				results.open(cfg.results_path, "image,label,predicted,correct,start_ns,latency_ns");
+			}
+			
+			//Every tenant gets a contiguous slice of the test images, streamed or preloaded
+			unsigned int images = (cfg.num_images > 0) ? cfg.num_images : TEST_IMAGES;
+			if(images < cfg.tenants){
+				SC_REPORT_FATAL(this->name(), "fewer test images than tenants");
+			}
+			/*
+			Batched results read the labels from the test set's labels array, or when streaming from a
+			label ring per tenant after the tenants' rings. A ring holds whole batches and at least
+			DATASET_RING_SLOTS labels more than one, so the loader never reaches a batch not yet read
+			back. The results arrays come next. Labels and results are packed EIE_RESULTS_PER_WORD
+			to a word.
+			*/
+			unsigned int label_slots = 0, ring_words = 0, labels_offset = dram->test_labels_offset;
+			unsigned int label_words = (TEST_IMAGES + EIE_RESULTS_PER_WORD - 1) / EIE_RESULTS_PER_WORD;
+			if(cfg.results_batch > 0 && cfg.num_images > 0){
+				label_slots = (cfg.results_batch + DATASET_RING_SLOTS + cfg.results_batch - 1) / cfg.results_batch * cfg.results_batch;
+				ring_words = (label_slots + EIE_RESULTS_PER_WORD - 1) / EIE_RESULTS_PER_WORD;
+				labels_offset = dram->test_set_offset + cfg.tenants * DATASET_RING_SLOTS * MNIST_IMAGE_WORDS;
+				label_words = cfg.tenants * ring_words;
+			}else if(cfg.results_batch > 0 && labels_offset == 0){
+				SC_REPORT_FATAL(this->name(), "no labels array after the test set for batched results");
+			}
+			unsigned int batch_words = (cfg.results_batch + EIE_RESULTS_PER_WORD - 1) / EIE_RESULTS_PER_WORD;
+			unsigned int results_offset = labels_offset + label_words;
+			
+			for (unsigned int k = 0; k < cfg.tenants; k++) {
+				std::string suffix = (k == 0) ? "" : "_" + std::to_string(k);
+				unsigned int first = k * images / cfg.tenants;
+				unsigned int count = (k + 1) * images / cfg.tenants - first;
 				
-				eie_accels[i] = new EIE_accelerator(name.c_str());
-				eie_accels[i] -> clk(int_clk);
-
-				eie_cc -> accelerators[i](*eie_accels[i]);
+				EIE_SW_module *sw = new EIE_SW_module(("EIE_SW" + suffix).c_str());
+				sw -> split_reads = cfg.split_reads;
+				sw -> results_batch = cfg.results_batch;
+				sw -> results_offset = results_offset + k * batch_words;
+				sw -> labels_offset = labels_offset + k * ring_words;
+				sw -> label_slots = label_slots;
+				sw -> packed_weights = dram->packed_weights;
+				sw -> cc_base = EIE_CC_BASE_ADDR + k * EIE_CC_ADDR_SIZE;
+				sw -> master_id = BUS_MST_SW + 2 * k;
+				sw -> num_images = count;
+				sw -> first_image = first;
+				if(results.is_open()){
+					sw -> results = &results;
+				}
+				if(cfg.num_images > 0){
+					std::string name("MY_DATASET" + suffix);
+					unsigned int ring = dram->test_set_offset + k * DATASET_RING_SLOTS * MNIST_IMAGE_WORDS;
+					dataset_loader *loader = new dataset_loader(name.c_str(), cfg.first_image + first, count, ring);
+					if(loader->count == 0){
+						SC_REPORT_FATAL(this->name(), "no test images to stream");
+					}
+					loader -> dram(*dram);
+					loader -> coherence(*cross_bus);
+					loader -> labels = labels_offset + k * ring_words;
+					loader -> label_slots = label_slots;
+					sw -> dataset(*loader);
+					sw -> num_images = loader->count;
+					sw -> first_image = cfg.first_image + first;
+					loaders.push_back(loader);
+				}
+				eie_sws.push_back(sw);
+				
+				EIE_central_control *cc = new EIE_central_control(("EIE_CENTRAL_CONTROL" + suffix).c_str());
+				cc -> clk(int_clk);
+				cc -> split_reads = cfg.split_reads;
+				cc -> max_outstanding = outstanding;
+				cc -> use_dmi = cfg.dmi;
+				cc -> base_addr = sw->cc_base;
+				cc -> master_id = BUS_MST_HW + 2 * k;
+				eie_ccs.push_back(cc);
+				
+				if(cfg.loosely_timed){
+					sw -> master_socket.bind(lt_bus->targ_socket);
+					cc -> master_socket.bind(lt_bus->targ_socket);
+					lt_bus -> init_socket.bind(cc->minion_socket);
+					lt_bus -> map_target((int) k, cc->base_addr, EIE_CC_ADDR_SIZE);
+				}else if(cfg.crossbar){
+					sw -> bus(xbar->master(sw->master_id));
+					cc -> bus_master(xbar->master(cc->master_id));
+					cc -> bus_minion(xbar->slave(k));
+					xbar -> map_slave(k, cc->minion_id, cc->base_addr, EIE_CC_ADDR_SIZE);
+				}else{
+					sw -> bus(*bus);
+					cc -> bus_master(*bus);
+					cc -> bus_minion(*bus);
+					bus -> attach_minion(cc->minion_id, cc->base_addr, EIE_CC_ADDR_SIZE);
+				}
+				
+				for (int i = 0; i < NUM_ACCELERATORS; i++) {
+					std::string name("EIE_ACCELERATOR_" + (k == 0 ? "" : std::to_string(k) + "_") + std::to_string(i));
+					
+					EIE_accelerator *accel = new EIE_accelerator(name.c_str());
+					accel -> clk(int_clk);
+					accel -> loosely_timed = cfg.loosely_timed;
+					
+					cc -> accelerators[i](*accel);
+					eie_accels.push_back(accel);
+				}
 			}
+			eie_sw = eie_sws[0];
+			eie_cc = eie_ccs[0];
 			
+			//the DRAM is the last target behind the CCs
+			if(cfg.loosely_timed){
+				lt_bus -> init_socket.bind(cross_bus->minion_socket);
+				lt_bus -> map_target((int) cfg.tenants, DRAM_BASE_ADDR, DRAM_SIZE);
+			}else if(cfg.crossbar){
+				cross_bus -> internal_bus(xbar->slave(cfg.tenants));
+				xbar -> map_slave(cfg.tenants, cross_bus->minion_id, DRAM_BASE_ADDR, DRAM_SIZE);
+			}else{
+				cross_bus -> internal_bus(*bus);
+				bus -> attach_minion(cross_bus->minion_id, DRAM_BASE_ADDR, DRAM_SIZE);
+			}
 		}
 		
 		void event_tracker(){
-			//See when EIE_SW is done loading weights
-			cout << "HELLO???\n";
-			wait(eie_sw->done_weight_init);
+			//See when every EIE_SW is done loading weights
+			LOG_DEBUG(LOG_TOP, "event tracker running");
+			for (unsigned int k = 0; k < eie_sws.size(); k++) {
+				if(!eie_sws[k]->weights_loaded){
+					wait(eie_sws[k]->done_weight_init);
+				}
+			}
 
 			sc_time weightTime = sc_time_stamp();
-			unsigned int weight_phase_dram = eie_sw->tally_dram_access + cross_bus->transfer_tally;
-			double weight_phase_power = weight_phase_dram * POWER_DRAM;
+			double weight_phase_power = dram_energy(cross_bus->transfer_tally, tenant_sum(eie_sws, &EIE_SW_module::tally_dram_access))
+			                          + POWER_CODEBOOK*tenant_sum(eie_ccs, &EIE_central_control::tally_codebook_lookups);
 
-			wait(eie_sw->done_execution);
+			for (unsigned int k = 0; k < eie_sws.size(); k++) {
+				if(!eie_sws[k]->finished){
+					wait(eie_sws[k]->done_execution);
+				}
+			}
+			//a write-back cache still owes the DRAM its dirty lines
+			cross_bus->flush_cache();
+			
+			unsigned int num_images = tenant_sum(eie_sws, &EIE_SW_module::num_images);
+			unsigned int good_predictions = tenant_sum(eie_sws, &EIE_SW_module::good_predictions);
+			cout << "Predicted " << good_predictions << "/" << num_images << " (" << (double) good_predictions / num_images << ")" << endl;
 			
 			//DRAM accesses from CPU (expected due to instruction loading) and the cross_bus tally
-			unsigned int total_dram_tally = eie_sw->tally_dram_access + cross_bus->transfer_tally;
+			unsigned int fetch_dram_tally = tenant_sum(eie_sws, &EIE_SW_module::tally_dram_access);
 			
 			//SRAM accesses and float operations from EIE_ACC only
-			unsigned int sram_tally = 0;
-			unsigned int float_add_tally = 0;
-			unsigned int float_mult_tally = 0;
+			unsigned int sram_tally = tenant_sum(eie_accels, &EIE_accelerator::tally_sram_access);
+			unsigned int float_add_tally = tenant_sum(eie_accels, &EIE_accelerator::tally_float_add);
+			unsigned int float_mult_tally = tenant_sum(eie_accels, &EIE_accelerator::tally_float_multiply);
 			
-			for (int i = 0; i < NUM_ACCELERATORS; i++) {
-				sram_tally += eie_accels[i] -> tally_sram_access;
-				float_add_tally += eie_accels[i] -> tally_float_add;
-				float_mult_tally += eie_accels[i] -> tally_float_multiply;
-			}
+			unsigned int tally_cc_bus = tenant_sum(eie_ccs, &EIE_central_control::tally_transfers_acc_bus);
 			
-			unsigned int tally_cc_bus = eie_cc->tally_transfers_acc_bus;
-			
-			unsigned int tally_bus = bus->tally_bus_transfers;
+			unsigned int tally_bus, tally_bus_beats;
+			if(lt_bus){
+				tally_bus = lt_bus->tally_bus_transfers;
+				tally_bus_beats = lt_bus->tally_bus_beats;
+			}else if(xbar){
+				tally_bus = xbar->tally_bus_transfers();
+				tally_bus_beats = xbar->tally_bus_beats();
+			}else{
+				tally_bus = bus->tally_bus_transfers;
+				tally_bus_beats = bus->tally_bus_beats;
+			}
 			
-			unsigned int tally_cc_register = eie_cc->tally_output_read;
+			unsigned int tally_cc_register = tenant_sum(eie_ccs, &EIE_central_control::tally_output_read);
 			
-			unsigned int int_add_tally = eie_sw->tally_int_add;
-			unsigned int int_mult_tally = eie_sw->tally_int_multiply;
+			unsigned int int_add_tally = tenant_sum(eie_sws, &EIE_SW_module::tally_int_add);
+			unsigned int int_mult_tally = tenant_sum(eie_sws, &EIE_SW_module::tally_int_multiply);
 			
 			double power_float_ops = POWER_FL_ADD*float_add_tally + POWER_FL_MUL*float_mult_tally;
 			double power_int_ops   = POWER_INT_ADD*int_add_tally + POWER_INT_MUL*int_mult_tally;
 			double power_sram      = POWER_SRAM*sram_tally;
 			double power_acc_bus   = POWER_ACC_BUS*tally_cc_bus;
 			double power_bus       = POWER_BUS*tally_bus;
-			double power_dram      = POWER_DRAM*total_dram_tally;
+			double power_dram      = dram_energy(cross_bus->transfer_tally, fetch_dram_tally);
 			double power_register  = POWER_REGISTER*tally_cc_register;
+			double power_cache     = 0;
+			if(cross_bus->cache){
+				power_cache = POWER_CACHE_TAG*cross_bus->cache->tally_tag_lookups + POWER_CACHE_DATA*cross_bus->cache->tally_data_words;
+			}
 			
-			double total_power = power_float_ops + power_int_ops + power_sram + power_acc_bus + power_bus + power_dram;
+			double power_codebook  = POWER_CODEBOOK*tenant_sum(eie_ccs, &EIE_central_control::tally_codebook_lookups);
+			
+			double total_power = power_float_ops + power_int_ops + power_sram + power_acc_bus + power_bus + power_dram + power_cache + power_codebook;
 			
 			cout << "\n----------------------------------\n";
 			cout << "\nDONE Project Simulation\n";
@@ -160,26 +433,189 @@ class project_top : public sc_module {
 			cout << "Power from accelerator bus = "    << power_acc_bus << " pJ\n";
 			cout << "Power from internal bus = "       << power_bus << " pJ\n";
 			cout << "Power from DRAM accesses = "      << power_dram << " pJ\n";
+			if(dram->banks_enabled()){
+				cout << "    activate = "  << POWER_DRAM_ACTIVATE*dram_sum(&DRAM::tally_activates) << " pJ, ";
+				cout << "read/write = "    << POWER_DRAM_RW*cross_bus->transfer_tally << " pJ, ";
+				cout << "precharge = "     << POWER_DRAM_PRECHARGE*dram_sum(&DRAM::tally_precharges) << " pJ, ";
+				cout << "instruction fetch = " << POWER_DRAM*fetch_dram_tally << " pJ\n";
+			}
 			cout << "Power from register accesses = "  << power_register << " pJ\n";
+			if(cross_bus->cache){
+				cout << "Power from DRAM cache = "     << power_cache << " pJ\n";
+			}
+			if(dram->packed_weights){
+				cout << "Power from weight decoding = " << power_codebook << " pJ\n";
+			}
 			cout << "\n----------------------------------\n";
 			cout << "\nTotal power = " << total_power << " pJ\n";
 			cout << "\n----------------------------------\n";
 			cout << "Weight Phase\n";
 			cout << "Time Spent: " << weightTime << endl;
-			cout << "Used " << POWER_DRAM * weight_phase_dram << " pJ";
+			cout << "Used " << weight_phase_power << " pJ";
 			cout << "\n----------------------------------\n";
-			cout << "Inference Phase (" << TEST_IMAGES << " images)\n";
+			cout << "Inference Phase (" << num_images << " images)\n";
 			cout << "Time Spent: " << sc_time_stamp() - weightTime << endl;
 			cout << "Power used for inference = " << total_power - weight_phase_power << " pJ" << endl;
 			cout << "\n----------------------------------\n";
 			cout << "Per Image" << endl;
-			cout << "Average Time Spent: " << (sc_time_stamp() - weightTime) / TEST_IMAGES << endl;
-			cout << "Average Power Consumed = " << (total_power - weight_phase_power) / TEST_IMAGES << " pJ" << endl;
+			cout << "Average Time Spent: " << (sc_time_stamp() - weightTime) / num_images << endl;
+			cout << "Average Power Consumed = " << (total_power - weight_phase_power) / num_images << " pJ" << endl;
+			cout << "\n----------------------------------\n";
+			if(eie_sws.size() > 1){
+				//each tenant from its own end of weight loading, the whole system from the first one's
+				sc_time first_start = weightTime;
+				cout << "Tenants (" << eie_sws.size() << " CPU/CC pairs)\n";
+				for (unsigned int k = 0; k < eie_sws.size(); k++) {
+					const EIE_SW_module *sw = eie_sws[k];
+					first_start = std::min(first_start, sw->weights_loaded_at);
+					cout << "Tenant " << k << ": images " << sw->first_image << "-" << sw->first_image + sw->num_images - 1;
+					cout << ", predicted " << sw->good_predictions << "/" << sw->num_images;
+					cout << ", weights at " << sw->weights_loaded_at << ", done at " << sw->finished_at;
+					cout << ", " << sw->num_images / ((sw->finished_at - sw->weights_loaded_at).to_seconds() * 1e3) << " images/ms" << endl;
+				}
+				cout << "Throughput: " << num_images / ((sc_time_stamp() - first_start).to_seconds() * 1e3) << " images/ms" << endl;
+				cout << "\n----------------------------------\n";
+			}
+			if(lt_bus){
+				cout << "Internal Bus (" << lt_bus->data_width() << "-bit, loosely timed, quantum ";
+				cout << tlm_utils::tlm_quantumkeeper::get_global_quantum() << ")\n";
+				cout << "Words transferred: " << tally_bus << endl;
+				cout << "Beats: " << tally_bus_beats << endl;
+				cout << "Address/data utilization: " << 100.0 * (lt_bus->busy_time / sc_time_stamp()) << " %" << endl;
+			}else if(xbar){
+				std::vector<std::string> master_names, slave_names;
+				for (unsigned int k = 0; k < eie_sws.size(); k++) {
+					std::string tenant = (eie_sws.size() > 1) ? " " + std::to_string(k) : "";
+					master_names.push_back("CPU" + tenant);
+					master_names.push_back("CC" + tenant + " DMA");
+					slave_names.push_back("CC" + tenant + " registers");
+				}
+				slave_names.push_back("DRAM bridge");
+				cout << "Internal Crossbar (" << xbar->data_width() << "-bit, " << xbar->arbitration_name() << " per slave)\n";
+				cout << "Words transferred: " << tally_bus << endl;
+				cout << "Beats: " << tally_bus_beats << endl;
+				for (unsigned int i = 0; i < xbar->num_masters(); i++) {
+					cout << "Master port " << i << " (" << master_names[i] << ") utilization: " << 100.0 * (xbar->master_busy_time(i) / sc_time_stamp()) << " %" << endl;
+				}
+				for (unsigned int i = 0; i < xbar->num_slaves(); i++) {
+					cout << "Slave port " << i << " (" << slave_names[i] << ") utilization: " << 100.0 * (xbar->slave_busy_time(i) / sc_time_stamp()) << " %";
+					cout << ", split responses " << 100.0 * (xbar->slave_response_busy_time(i) / sc_time_stamp()) << " %" << endl;
+				}
+			}else{
+				cout << "Internal Bus (" << bus->data_width() << "-bit, " << bus->arbitration_name() << ")\n";
+				cout << "Words transferred: " << tally_bus << endl;
+				cout << "Beats: " << tally_bus_beats << endl;
+				cout << "Address/data utilization: " << 100.0 * (bus->busy_time / sc_time_stamp()) << " %" << endl;
+				cout << "Split response utilization: " << 100.0 * (bus->response_busy_time / sc_time_stamp()) << " %" << endl;
+			}
 			cout << "\n----------------------------------\n";
 			
+			if(dram->banks_enabled()){
+				unsigned long long accesses = dram_sum(&DRAM::tally_row_hits) + dram_sum(&DRAM::tally_row_misses) + dram_sum(&DRAM::tally_row_conflicts);
+				cout << "DRAM Banks (" << DRAM_BANKS << " x " << DRAM_ROW_WORDS << "-word rows, ";
+				cout << (dram->open_page_policy() ? "open" : "closed") << " page, tRCD " << DRAM_TRCD << " tCL " << DRAM_TCL;
+				cout << " tCWL " << DRAM_TCWL << " tRP " << DRAM_TRP << " tRAS " << DRAM_TRAS << ")\n";
+				cout << "Accesses: " << accesses << ", words: " << dram_sum(&DRAM::tally_words) << endl;
+				cout << "Row hits: " << dram_sum(&DRAM::tally_row_hits) << " (" << (accesses ? 100.0 * dram_sum(&DRAM::tally_row_hits) / accesses : 0.0) << " %)";
+				cout << ", misses: " << dram_sum(&DRAM::tally_row_misses) << ", conflicts: " << dram_sum(&DRAM::tally_row_conflicts) << endl;
+				cout << "Activates: " << dram_sum(&DRAM::tally_activates) << ", precharges: " << dram_sum(&DRAM::tally_precharges) << endl;
+				cout << "\n----------------------------------\n";
+			}
+			
+			if(drams.size() > 1){
+				cout << "DRAM Channels (" << drams.size() << ", interleaved by " << cross_bus->interleave_words << " words)\n";
+				for (unsigned int i = 0; i < drams.size(); i++) {
+					cout << "Channel " << i << ": " << cross_bus->tally_channel_words[i] << " words, utilization ";
+					cout << 100.0 * (cross_bus->channel_busy[i] / sc_time_stamp()) << " %" << endl;
+				}
+				cout << "\n----------------------------------\n";
+			}
+			
+			if(cross_bus->prefetch_depth > 0){
+				unsigned long long prefetched = cross_bus->tally_prefetched;
+				unsigned long long used = cross_bus->tally_prefetch_used;
+				unsigned long long reads = cross_bus->tally_stream_read_words;
+				cout << "Stream Prefetcher (" << cross_bus->prefetch_depth << " words)\n";
+				cout << "Prefetched words: " << prefetched << ", used: " << used << ", discarded: " << cross_bus->tally_prefetch_discarded << endl;
+				cout << "Accuracy: " << (prefetched ? 100.0 * used / prefetched : 0.0) << " %" << endl;
+				cout << "Coverage: " << (reads ? 100.0 * used / reads : 0.0) << " %" << endl;
+				cout << "\n----------------------------------\n";
+			}
+			
+			if(dram->packed_weights){
+				unsigned long long packed = tenant_sum(eie_ccs, &EIE_central_control::tally_packed_words);
+				unsigned long long weights = tenant_sum(eie_ccs, &EIE_central_control::tally_unpacked_weights);
+				cout << "Packed Weights\n";
+				cout << "Weights: " << weights << ", packed words read: " << packed;
+				cout << " (" << (packed ? (double) weights / packed : 0.0) << "x)" << endl;
+				cout << "Codebook lookups: " << tenant_sum(eie_ccs, &EIE_central_control::tally_codebook_lookups) << ", DRAM words saved: " << weights - packed << endl;
+				cout << "\n----------------------------------\n";
+			}
+			if(cross_bus->write_buffer_depth > 0 && !cross_bus->cache && !lt_bus){
+				cout << "Write Buffer (" << cross_bus->write_buffer_depth << " words)\n";
+				cout << "Posted words: " << cross_bus->tally_posted_writes << ", DRAM bursts: " << cross_bus->tally_write_drains;
+				cout << ", forwarded to reads: " << cross_bus->tally_write_forwarded << endl;
+				cout << "Peak occupancy: " << cross_bus->write_buffer_peak << " words, time full: " << cross_bus->write_buffer_stall << endl;
+				cout << "\n----------------------------------\n";
+			}
+			
+			if(cross_bus->cache){
+				const dram_cache *c = cross_bus->cache;
+				unsigned long long reads = c->read_hits + c->read_misses;
+				unsigned long long writes = c->write_hits + c->write_misses;
+				cout << "DRAM Cache (" << c->config().size_bytes << " B, " << c->config().ways << "-way, ";
+				cout << c->config().line_bytes << " B lines, " << (c->config().write_back ? "write-back" : "write-through") << ", ";
+				cout << (c->config().plru ? "PLRU" : "LRU") << ")\n";
+				cout << "Reads: " << c->read_hits << " hits, " << c->read_misses << " misses";
+				cout << " (hit rate " << (reads ? 100.0 * c->read_hits / reads : 0.0) << " %)" << endl;
+				cout << "Writes: " << c->write_hits << " hits, " << c->write_misses << " misses";
+				cout << " (hit rate " << (writes ? 100.0 * c->write_hits / writes : 0.0) << " %)" << endl;
+				cout << "Line fills: " << c->line_fills << ", write-backs: " << c->line_writebacks;
+				cout << ", DRAM bursts: " << cross_bus->burst_tally << endl;
+				cout << "Dirty lines written back at the end: " << cross_bus->flushed_lines << endl;
+				cout << "Cache SRAM energy: " << power_cache << " pJ" << endl;
+				cout << "\n----------------------------------\n";
+			}
+			
+			if(trace){
+				trace->close();
+				cout << "Bus trace: " << trace->records_written << " transactions\n";
+				cout << "\n----------------------------------\n";
+			}
+			results.close();
+			
 			sc_stop();
 		}
 		
+		//A tally summed over the tenants' CPUs, CCs or accelerators
+		template <class M, class T>
+		unsigned long long tenant_sum(const std::vector<M *> &modules, T M::*tally){
+			unsigned long long sum = 0;
+			for (unsigned int i = 0; i < modules.size(); i++) {
+				sum += modules[i]->*tally;
+			}
+			return sum;
+		}
+		
+		//A bank model tally summed over the channels
+		unsigned long long dram_sum(unsigned long long DRAM::*tally){
+			unsigned long long sum = 0;
+			for (unsigned int i = 0; i < drams.size(); i++) {
+				sum += drams[i]->*tally;
+			}
+			return sum;
+		}
+		
+		//DRAM energy of the words moved through the DRAM modules, split by command when the bank model is on,
+		//and of the CPU's instruction fetches, which the bank model does not see and pay the whole POWER_DRAM
+		double dram_energy(unsigned int words, unsigned int fetch_words){
+			if(!dram->banks_enabled()){
+				return POWER_DRAM*(words + fetch_words);
+			}
+			return POWER_DRAM_ACTIVATE*dram_sum(&DRAM::tally_activates) + POWER_DRAM_RW*words + POWER_DRAM_PRECHARGE*dram_sum(&DRAM::tally_precharges)
+			     + POWER_DRAM*fetch_words;
+		}
+		
 		void init_print(){
 			cout << "\n---------------------------\n";
 			cout << "\nStarting Project Simulation\n";
@@ -188,34 +624,198 @@ class project_top : public sc_module {
 }; //End module project_top
 
 void print_help(){
-	cout << "Project Usage: ./Proj_exec <-h> <-v>" << endl;
+	cout << "Project Usage: ./Proj_exec <-h> <-v|-vv> <-L categories> <-R file> <-w bits> <-s> <-a policy> <-q master:prio:weight> <-x> <-l> <-t ns> <-d> <-T file> <-c cache> <-P page> <-p words> <-b words> <-C channels> <-i image> <-n images> <-B images> <-k tenants>" << endl;
 	cout << "    For help    : ./Proj_exec -h" << endl;
-	cout << "    For verbose : ./Proj_exec -v" << endl;
+	cout << "    For verbose : ./Proj_exec -v (info) or -vv (debug)" << endl;
+	cout << "    Log filter  : ./Proj_exec -L <all|top,sw,cc,acc,bus,xbus,dram,loader>" << endl;
+	cout << "    Results CSV : ./Proj_exec -R <file>" << endl;
+	cout << "    Bus width   : ./Proj_exec -w <32|64|128|256>" << endl;
+	cout << "    Split reads : ./Proj_exec -s" << endl;
+	cout << "    Arbitration : ./Proj_exec -a <rr|fp|wrr|tdma>" << endl;
+	cout << "    Master QoS  : ./Proj_exec -q <0|1>:<priority>:<weight>" << endl;
+	cout << "    Crossbar    : ./Proj_exec -x" << endl;
+	cout << "    TLM-2.0 LT  : ./Proj_exec -l" << endl;
+	cout << "    LT quantum  : ./Proj_exec -l -t <ns>" << endl;
+	cout << "    LT with DMI : ./Proj_exec -l -d" << endl;
+	cout << "    Bus trace   : ./Proj_exec -T <file>" << endl;
+	cout << "    DRAM cache  : ./Proj_exec -c <bytes>:<ways>:<line bytes>[:wb|wt][:lru|plru]" << endl;
+	cout << "    DRAM banks  : ./Proj_exec -P <open|closed>" << endl;
+	cout << "    Prefetcher  : ./Proj_exec -p <buffer words, up to " << CROSS_BUS_MAX_PREFETCH_WORDS << ">" << endl;
+	cout << "    Write buffer: ./Proj_exec -b <buffer words, up to " << CROSS_BUS_MAX_WRITE_BUFFER_WORDS << ">" << endl;
+	cout << "    Channels    : ./Proj_exec -C <channels>[:line|page]" << endl;
+	cout << "    DRAM image  : ./Proj_exec -i <image from dram_image_convert>" << endl;
+	cout << "    Packed weights: ./Proj_exec -i <image from dram_image_convert -z>" << endl;
+	cout << "    Test images : ./Proj_exec -n [first:]<count>, streamed from MNIST/" << endl;
+	cout << "    Batch results: ./Proj_exec -B <images>, read back from DRAM per batch" << endl;
+	cout << "    Tenants     : ./Proj_exec -k <CPU/CC pairs, up to " << EIE_MAX_TENANTS << ">" << endl;
+}
+
+//Parse -c <bytes>:<ways>:<line bytes>[:wb|wt][:lru|plru], false if the geometry is not valid
+bool parse_cache_spec(const char *spec, cache_config &cfg){
+	std::stringstream in(spec);
+	std::string field;
+	std::vector<std::string> fields;
+	while(std::getline(in, field, ':')){
+		fields.push_back(field);
+	}
+	if(fields.size() < 3){
+		return false;
+	}
+	cfg.size_bytes = (unsigned int) atoi(fields[0].c_str());
+	cfg.ways = (unsigned int) atoi(fields[1].c_str());
+	cfg.line_bytes = (unsigned int) atoi(fields[2].c_str());
+	for(unsigned int i = 3; i < fields.size(); i++){
+		if(fields[i] == "wb"){
+			cfg.write_back = true;
+		}else if(fields[i] == "wt"){
+			cfg.write_back = false;
+		}else if(fields[i] == "lru"){
+			cfg.plru = false;
+		}else if(fields[i] == "plru"){
+			cfg.plru = true;
+		}else{
+			return false;
+		}
+	}
+	return dram_cache::valid(cfg);
+}
+
+//Elaborate the design on the given clocks and run it to the end
+void run_top(const sim_config &cfg, sc_signal_in_if<bool> &int_clk, sc_signal_in_if<bool> &ext_clk){
+	project_top top("top", cfg);
+	top.int_clk(int_clk);
+	top.ext_clk(ext_clk);
+	sc_start();
 }
 
 int sc_main(int argc, char* argv[]){
-	bool user_verbosity = false;
-	if(argc > 1){
-		std::string arg1 = std::string(argv[1]);
-		if(arg1 == "-h" || arg1 == "--help"){
+	sim_config cfg;
+	for(int i = 1; i < argc; i++){
+		std::string arg = std::string(argv[i]);
+		if(arg == "-h" || arg == "--help"){
 			print_help();
 			exit(EXIT_FAILURE);
-		}else if(arg1 == "-v" || arg1 == "--verbose"){
-			user_verbosity = true;
+		}else if(arg == "-v" || arg == "--verbose"){
+			cfg.log_level = std::min(cfg.log_level + 1, LOG_LEVEL_TRACE);
+		}else if(arg == "-vv"){
+			cfg.log_level = std::min(cfg.log_level + 2, LOG_LEVEL_TRACE);
+		}else if((arg == "-L" || arg == "--log") && i + 1 < argc){
+			if(!sim_log::parse_categories(argv[++i], cfg.log_categories)){
+				print_help();
+				exit(EXIT_FAILURE);
+			}
+		}else if((arg == "-R" || arg == "--results") && i + 1 < argc){
+			cfg.results_path = std::string(argv[++i]);
+		}else if((arg == "-w" || arg == "--bus-width") && i + 1 < argc){
+			cfg.bus_width = (unsigned int) atoi(argv[++i]);
+		}else if(arg == "-s" || arg == "--split"){
+			cfg.split_reads = true;
+		}else if((arg == "-a" || arg == "--arbitration") && i + 1 < argc){
+			cfg.arbitration = std::string(argv[++i]);
+			bus_arb_policy *check = make_arb_policy(cfg.arbitration);
+			if(check == NULL){
+				print_help();
+				exit(EXIT_FAILURE);
+			}
+			delete check;
+		}else if((arg == "-q" || arg == "--qos") && i + 1 < argc){
+			unsigned int mst, prio, weight;
+			if(sscanf(argv[++i], "%u:%u:%u", &mst, &prio, &weight) != 3 || mst > BUS_MST_HW){
+				print_help();
+				exit(EXIT_FAILURE);
+			}
+			cfg.qos[mst].priority = prio;
+			cfg.qos[mst].weight = weight;
+		}else if(arg == "-x" || arg == "--crossbar"){
+			cfg.crossbar = true;
+		}else if(arg == "-l" || arg == "--loosely-timed"){
+			cfg.loosely_timed = true;
+		}else if((arg == "-t" || arg == "--quantum") && i + 1 < argc){
+			cfg.quantum_ns = atof(argv[++i]);
+		}else if(arg == "-d" || arg == "--dmi"){
+			cfg.dmi = true;
+		}else if((arg == "-T" || arg == "--trace") && i + 1 < argc){
+			cfg.trace_path = std::string(argv[++i]);
+		}else if((arg == "-c" || arg == "--cache") && i + 1 < argc){
+			if(!parse_cache_spec(argv[++i], cfg.cache_cfg)){
+				print_help();
+				exit(EXIT_FAILURE);
+			}
+			cfg.cache = true;
+		}else if((arg == "-p" || arg == "--prefetch") && i + 1 < argc){
+			int depth = atoi(argv[++i]);
+			if(depth < 0 || depth > CROSS_BUS_MAX_PREFETCH_WORDS){
+				print_help();
+				exit(EXIT_FAILURE);
+			}
+			cfg.prefetch_depth = (unsigned int) depth;
+		}else if((arg == "-b" || arg == "--write-buffer") && i + 1 < argc){
+			int depth = atoi(argv[++i]);
+			if(depth < 0 || depth > CROSS_BUS_MAX_WRITE_BUFFER_WORDS){
+				print_help();
+				exit(EXIT_FAILURE);
+			}
+			cfg.write_buffer_depth = (unsigned int) depth;
+		}else if((arg == "-C" || arg == "--channels") && i + 1 < argc){
+			std::string spec(argv[++i]);
+			size_t colon = spec.find(':');
+			std::string unit = colon == std::string::npos ? "line" : spec.substr(colon + 1);
+			cfg.dram_channels = (unsigned int) atoi(spec.substr(0, colon).c_str());
+			if(cfg.dram_channels < 1 || cfg.dram_channels > DRAM_MAX_CHANNELS || (unit != "line" && unit != "page")){
+				print_help();
+				exit(EXIT_FAILURE);
+			}
+			cfg.page_interleave = (unit == "page");
+		}else if((arg == "-n" || arg == "--images") && i + 1 < argc){
+			std::string spec(argv[++i]);
+			size_t colon = spec.find(':');
+			cfg.first_image = colon == std::string::npos ? 0 : (unsigned int) atoi(spec.substr(0, colon).c_str());
+			cfg.num_images = (unsigned int) atoi(spec.substr(colon == std::string::npos ? 0 : colon + 1).c_str());
+			if(cfg.num_images < 1){
+				print_help();
+				exit(EXIT_FAILURE);
+			}
+		}else if((arg == "-B" || arg == "--batch") && i + 1 < argc){
+			cfg.results_batch = (unsigned int) atoi(argv[++i]);
+			if(cfg.results_batch < 1){
+				print_help();
+				exit(EXIT_FAILURE);
+			}
+		}else if((arg == "-k" || arg == "--tenants") && i + 1 < argc){
+			cfg.tenants = (unsigned int) atoi(argv[++i]);
+			if(cfg.tenants < 1 || cfg.tenants > EIE_MAX_TENANTS){
+				print_help();
+				exit(EXIT_FAILURE);
+			}
+		}else if((arg == "-i" || arg == "--image") && i + 1 < argc){
+			cfg.image_path = std::string(argv[++i]);
+		}else if((arg == "-P" || arg == "--page-policy") && i + 1 < argc){
+			std::string policy(argv[++i]);
+			if(policy != "open" && policy != "closed"){
+				print_help();
+				exit(EXIT_FAILURE);
+			}
+			cfg.dram_banks = true;
+			cfg.open_page = (policy == "open");
 		}else{
 			print_help();
 			exit(EXIT_FAILURE);
 		}
 	}
 	
-	sc_clock internal_clock ("internal_clock", clock_period_int, SC_NS);  
-	sc_clock external_clock ("exernal_clock", clock_period_ex, SC_NS);  
-	
-	project_top top("top", user_verbosity);
-	top.int_clk(internal_clock);
-	top.ext_clk(external_clock);
+	sim_log::level() = cfg.log_level;
+	sim_log::categories() = cfg.log_categories;
 	
-	sc_start();
+	//Nothing follows the clocks in the loosely-timed model, so they are not generated at all
+	if(cfg.loosely_timed){
+		sc_signal<bool> internal_tie("internal_tie");
+		sc_signal<bool> external_tie("external_tie");
+		run_top(cfg, internal_tie, external_tie);
+	}else{
+		sc_clock internal_clock("internal_clock", clock_period_int, SC_NS);
+		sc_clock external_clock("exernal_clock", clock_period_ex, SC_NS);
+		run_top(cfg, internal_clock, external_clock);
+	}
 	
 	return 0;
 }
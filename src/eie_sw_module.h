@@ -1,6 +1,14 @@
 #pragma once
 
 #include <systemc.h>
+#include <tlm.h>
+#include <tlm_utils/simple_initiator_socket.h>
+#include <tlm_utils/tlm_quantumkeeper.h>
+
+#include "tlm_bus.h"
+#include "weight_codec.h"
+#include "dataset_loader.h"
+#include "sim_log.h"
 
 /*************************************************************
 EIE_SW_Module.h is the CPU module of the EIE system. This 
@@ -24,6 +32,54 @@ POWER MODELLING:
 		- 32-bit int multiply = 3.1 pJ
 		- 32-bit float multiply = 3.7 pJ
 
+STREAMED TEST SET:
+	num_images images are tested, TEST_IMAGES by default.
+	With dataset bound (dataset_loader.h) every image is
+	acquired from the loader's DRAM ring before it is handed
+	to the control unit and released after its label is
+	read, otherwise the images follow each other in DRAM
+	after the weights, starting with image first_image.
+
+BATCHED RESULTS:
+	With results_batch set the module no longer reads the
+	label and the predicted label of every image. It sets
+	EIE_CC_ADDR_RESULTS with every image, so the control unit
+	keeps the predicted labels, and polls
+	EIE_CC_ADDR_OUTREADY as before. Once the batch is full or
+	the run is over it has the control unit write them to
+	the results array at results_offset
+	(EIE_CC_OP_WRITE_RESULTS) and reads back the labels of
+	the batch and the predicted labels with one burst each.
+	The labels are a contiguous array at labels_offset, placed
+	by the top module: the preloaded test set's labels array
+	(DRAM test_labels_offset) indexed by test set image, or
+	with dataset bound the loader's ring of label_slots
+	labels indexed by image of the run. Both arrays hold a
+	byte per image, EIE_RESULTS_PER_WORD to a word.
+
+RESULTS:
+	The result of every image is logged at debug level. With
+	results set it also goes to that CSV sink as one row of
+	image, label, predicted, correct, start_ns and
+	latency_ns, the latency from handing the image to the
+	control unit to reading its predicted label (to seeing
+	EIE_CC_ADDR_OUTREADY with batched results). The number of
+	correct predictions is left in good_predictions for the
+	top module.
+
+PACKED WEIGHTS:
+	With packed_weights set the weights in DRAM are in the
+	packed layout of weight_codec.h. The module first reads
+	the weight directory at the start of DRAM and then hands
+	every layer to the control unit with its packed length in
+	EIE_CC_ADDR_LEN. A length of 0 means dense weights.
+
+LOOSELY-TIMED MODEL:
+	If master_socket is bound (to tlm_bus) the bus port is
+	left unbound and every access is a b_transport call. The
+	module then runs ahead of simulation time by up to one
+	quantum and synchronises before it signals the top module.
+
 *************************************************************/
 
 class EIE_SW_module : public sc_module {
@@ -31,139 +87,293 @@ private:
     unsigned int layerDefs[NUM_LAYERS + 1] = LAYER_SIZES;
 
 public:
-    sc_port<bus_master_if> bus;
+    sc_port<bus_master_if, 1, SC_ZERO_OR_MORE_BOUND> bus;
+    tlm_utils::simple_initiator_socket_optional<EIE_SW_module> master_socket;
+    tlm_utils::tlm_quantumkeeper qk;
 	unsigned int tally_dram_access, tally_int_add, tally_int_multiply;
     sc_event done_weight_init;
 	sc_event done_execution;
+
+    // the events above have fired, and when (the top module may wait for them late)
+    bool weights_loaded, finished;
+    sc_time weights_loaded_at, finished_at;
+    unsigned int good_predictions;
+
+    // fetch labels from DRAM with split reads
+    bool split_reads;
+
+    // the weights are packed, see weight_codec.h
+    bool packed_weights;
+
+    // test images to run and the test set index of the first one
+    unsigned int num_images, first_image;
+    sc_port<dataset_if, 1, SC_ZERO_OR_MORE_BOUND> dataset;
+
+    // per-image results, NULL for none
+    csv_sink *results;
+
+    // status registers of this CPU's control unit and its bus master ID
+    unsigned int cc_base, master_id;
+
+    // images whose results the control unit collects in DRAM before they are read back, 0 for none,
+    // and the word offset of their array from DRAM_BASE_ADDR
+    unsigned int results_batch, results_offset;
+
+    // word offset of the labels array from DRAM_BASE_ADDR, and its length in labels when it is the loader's ring
+    unsigned int labels_offset, label_slots;
 	
     SC_HAS_PROCESS(EIE_SW_module);
 
-    EIE_SW_module(sc_module_name name) : sc_module(name) {
+    EIE_SW_module(sc_module_name name) : sc_module(name), master_socket("master_socket") {
 		
 		tally_dram_access = 0;
 		tally_int_add = 0;
 		tally_int_multiply = 0;
+		split_reads = false;
+		packed_weights = false;
+		num_images = TEST_IMAGES;
+		first_image = 0;
+		results = NULL;
+		cc_base = EIE_CC_BASE_ADDR;
+		master_id = BUS_MST_SW;
+		results_batch = 0;
+		results_offset = 0;
+		labels_offset = 0;
+		label_slots = 0;
+		weights_loaded = false;
+		finished = false;
+		good_predictions = 0;
 		
         SC_THREAD(sw_proc);
     }
 
     void sw_proc() {
-        cout << "EIE_SW running" << endl;
-        unsigned int req_addr, req_op, req_len;
+        LOG_INFO(LOG_SW, "EIE_SW running");
+        unsigned int req_addr, req_len;
+        qk.reset();
 		
 		//Add 640 pJ penalty for presumed reading of cpu instructions from DRAM. 
         tally_dram_access += 1;
 		
 		// load weights to accelerators
-        unsigned int ccstatus[10];
+        unsigned int ccstatus[10] = {0};
 
         unsigned int dram_addr = 0;
+
+        unsigned int directory[WEIGHT_DIR_WORDS];
+        if (packed_weights) {
+            bus_read(DRAM_BASE_ADDR, directory, WEIGHT_DIR_WORDS);
+        }
         
         for (int i = 0; i < NUM_LAYERS; i++) {
             unsigned int insize = layerDefs[i];
             unsigned int outsize = layerDefs[i + 1];
 
-            req_addr = EIE_CC_BASE_ADDR;
+            req_addr = cc_base;
             req_len = 10;
-            req_op = OP_WRITE;
             
+            if (packed_weights) {
+                dram_addr = directory[2 * i];
+            }
+
             ccstatus[EIE_CC_ADDR_OP] = EIE_CC_OP_WRITE_WEIGHT;
             ccstatus[EIE_CC_ADDR_DATA] = dram_addr;
+            ccstatus[EIE_CC_ADDR_LEN] = packed_weights ? directory[2 * i + 1] : 0;
             ccstatus[EIE_CC_ADDR_LAYER] = i;
             ccstatus[EIE_CC_ADDR_ROWLEN] = insize;
             ccstatus[EIE_CC_ADDR_ROWS] = outsize;
 
-            bus->Request(BUS_MST_SW, req_addr, req_op, req_len);
-            bus->WaitForAcknowledge(BUS_MST_SW);
-            for (unsigned int j = 0; j < req_len; j++) {
-                bus->WriteData(ccstatus[j]);
-            }
+            bus_write(req_addr, ccstatus, req_len);
 
-            req_addr = EIE_CC_BASE_ADDR + EIE_CC_ADDR_OP_COMPLETE;
+            req_addr = cc_base + EIE_CC_ADDR_OP_COMPLETE;
             req_len = 1;
-            req_op = OP_READ;
 
             unsigned int done = 0;
             while (!done) {
-                bus->Request(BUS_MST_SW, req_addr, req_op, req_len);
-                bus->WaitForAcknowledge(BUS_MST_SW);
-                bus->ReadData(done);
+                bus_read(req_addr, &done, req_len);
             }
             
-            cout << "LAYER 0 DRAM_ADDR = " << dram_addr << endl;
+            LOG_INFO(LOG_SW, "layer " << i << " weights at DRAM offset " << dram_addr);
             dram_addr += insize * outsize;
         }
-        cout << "dram_addr = " << dram_addr << " after weight loading" << endl;
+        if (packed_weights) {
+            dram_addr = directory[2 * NUM_LAYERS];
+        }
+        if (dataset.size() == 0) {
+            dram_addr += first_image * MNIST_IMAGE_WORDS;
+        }
+        LOG_INFO(LOG_SW, "test set at DRAM offset " << dram_addr << " after weight loading");
         // Start pushing the MNIST inputs
         // set cc status to EIE_CC_OP_WRITE_INPUT
+        if (master_socket.size() > 0) {
+            qk.sync();
+        }
+        weights_loaded = true;
+        weights_loaded_at = sc_time_stamp();
         done_weight_init.notify();
         
 		unsigned int goodPredictions = 0;
+        std::vector<unsigned int> batch_labels(results_batch), batch_predicted(results_batch);
+        std::vector<sc_time> batch_start(results_batch), batch_latency(results_batch);
+
+        for (unsigned int i = 0; i < num_images; i++) {
+            unsigned int image_addr = (dataset.size() > 0) ? dataset->Acquire(i) : dram_addr;
+            unsigned int slot = (results_batch > 0) ? i % results_batch : 0;
+            sc_time start = local_time();
 
-        for (int i = 0; i < TEST_IMAGES; i++) {
-            req_addr = EIE_CC_BASE_ADDR;
+            req_addr = cc_base;
             req_len = 10;
-            req_op = OP_WRITE;
             
             ccstatus[EIE_CC_ADDR_OP] = EIE_CC_OP_WRITE_INPUT;
-            ccstatus[EIE_CC_ADDR_DATA] = dram_addr;
+            ccstatus[EIE_CC_ADDR_DATA] = image_addr;
             ccstatus[EIE_CC_ADDR_ROWLEN] = 28 * 28;
+            ccstatus[EIE_CC_ADDR_RESULTS] = (results_batch > 0) ? 1 : 0;
 
-            bus->Request(BUS_MST_SW, req_addr, req_op, req_len);
-            bus->WaitForAcknowledge(BUS_MST_SW);
-            for (unsigned int j = 0; j < req_len; j++) {
-                bus->WriteData(ccstatus[j]);
-            }
+            bus_write(req_addr, ccstatus, req_len);
 
-            req_addr = EIE_CC_BASE_ADDR + EIE_CC_ADDR_OUTREADY;
+            req_addr = cc_base + EIE_CC_ADDR_OUTREADY;
             req_len = 1;
-            req_op = OP_READ;
             
             unsigned int done = 0;
             while (!done) {
-                bus->Request(BUS_MST_SW, req_addr, req_op, req_len);
-                bus->WaitForAcknowledge(BUS_MST_SW);
-                bus->ReadData(done);
+                bus_read(req_addr, &done, req_len);
+            }
+            dram_addr += 28 * 28 + 1;
+
+            if (results_batch > 0) {
+                // the label is read from the labels array, the slot is free once the control unit has the image
+                if (dataset.size() > 0) {
+                    dataset->Release(i);
+                }
+                batch_start[slot] = start;
+                batch_latency[slot] = local_time() - start;
+                if (slot + 1 == results_batch || i + 1 == num_images) {
+                    ccstatus[EIE_CC_ADDR_OP] = EIE_CC_OP_WRITE_RESULTS;
+                    ccstatus[EIE_CC_ADDR_DATA] = results_offset;
+                    bus_write(cc_base, ccstatus, EIE_CC_ADDR_DATA + 1);
+                    done = 0;
+                    while (!done) {
+                        bus_read(cc_base + EIE_CC_ADDR_OP_COMPLETE, &done, 1);
+                    }
+
+                    // a batch starts at a multiple of results_batch, so it never wraps around the label ring
+                    unsigned int label = (dataset.size() > 0) ? (i - slot) % label_slots : first_image + i - slot;
+                    read_packed(labels_offset, label, batch_labels.data(), slot + 1);
+                    read_packed(results_offset, 0, batch_predicted.data(), slot + 1);
+                    for (unsigned int j = 0; j <= slot; j++) {
+                        goodPredictions += record_result(i - slot + j, batch_labels[j], batch_predicted[j], batch_start[j], batch_latency[j]);
+                    }
+                }
+                continue;
             }
 
-            req_addr = DRAM_BASE_ADDR + dram_addr + 28 * 28;
+            req_addr = DRAM_BASE_ADDR + image_addr + 28 * 28;
             req_len = 1;
-            req_op = OP_READ;
 
             unsigned int correctLabel;
-            bus->Request(BUS_MST_SW, req_addr, req_op, req_len);
-            bus->WaitForAcknowledge(BUS_MST_SW);
-            bus->ReadData(correctLabel);
+            bus_read(req_addr, &correctLabel, req_len);
 
-            req_addr = EIE_CC_BASE_ADDR + EIE_CC_ADDR_PREDICTED_LABEL;
+            req_addr = cc_base + EIE_CC_ADDR_PREDICTED_LABEL;
             req_len = 1;
-            req_op = OP_READ;
 
             unsigned int predLabel;
-            bus->Request(BUS_MST_SW, req_addr, req_op, req_len);
-            bus->WaitForAcknowledge(BUS_MST_SW);
-            bus->ReadData(predLabel);
+            bus_read(req_addr, &predLabel, req_len);
 
-            cout << "Image " << i << endl;
-            cout << "Correct Label: " << correctLabel << endl;
-            cout << "Predicted Label: " << predLabel << endl << endl;;
-            
-            if (correctLabel == predLabel) {
-                goodPredictions++;
-				tally_int_add += 1;
+            if (dataset.size() > 0) {
+                dataset->Release(i);
             }
 
-            dram_addr += 28 * 28 + 1;
-			
-			//tracking operations
-			tally_int_add += 2;
-			tally_int_multiply += 1;
+            goodPredictions += record_result(i, correctLabel, predLabel, start, local_time() - start);
         }
         
-        cout << "Predicted " << goodPredictions << "/" << TEST_IMAGES << " (" << (double) goodPredictions / TEST_IMAGES << ")" << endl;
+        LOG_INFO(LOG_SW, "predicted " << goodPredictions << "/" << num_images);
+        good_predictions = goodPredictions;
 		
 		//Notify the main module to stop execution and tally results
+        if (master_socket.size() > 0) {
+            qk.sync();
+        }
+        finished = true;
+        finished_at = sc_time_stamp();
         done_execution.notify();
 		
     }
+
+    // log the result of image i of the run and tally its comparison, 1 if it was predicted correctly
+    unsigned int record_result(unsigned int i, unsigned int correctLabel, unsigned int predLabel, sc_time start, sc_time latency) {
+        LOG_DEBUG(LOG_SW, "image " << first_image + i << ": label " << correctLabel << ", predicted " << predLabel);
+        if (results != NULL) {
+            results->row() << first_image + i << "," << correctLabel << "," << predLabel << "," << (correctLabel == predLabel)
+                           << "," << start.to_seconds() * 1e9 << "," << latency.to_seconds() * 1e9;
+            results->end_row();
+        }
+
+        //tracking operations
+        tally_int_add += 2;
+        tally_int_multiply += 1;
+        if (correctLabel == predLabel) {
+            tally_int_add += 1;
+            return 1;
+        }
+        return 0;
+    }
+
+    // read the n byte-sized results from result first on of the packed array at word offset array
+    void read_packed(unsigned int array, unsigned int first, unsigned int *results, unsigned int n) {
+        unsigned int skip = first % EIE_RESULTS_PER_WORD;
+        std::vector<unsigned int> words((skip + n + EIE_RESULTS_PER_WORD - 1) / EIE_RESULTS_PER_WORD);
+        bus_read(DRAM_BASE_ADDR + array + first / EIE_RESULTS_PER_WORD, words.data(), (unsigned int) words.size());
+        for (unsigned int j = 0; j < n; j++) {
+            results[j] = (words[(skip + j) / EIE_RESULTS_PER_WORD] >> (8 * ((skip + j) % EIE_RESULTS_PER_WORD))) & 0xff;
+        }
+    }
+
+    // simulation time of this thread, ahead of sc_time_stamp() by the local time when loosely timed
+    sc_time local_time() {
+        return (master_socket.size() > 0) ? qk.get_current_time() : sc_time_stamp();
+    }
+
+    // write len words at addr, over the TLM socket when it is bound
+    void bus_write(unsigned int addr, unsigned int *data, unsigned int len) {
+        bool ok;
+        if (master_socket.size() > 0) {
+            ok = lt_transport(master_socket, qk, tlm::TLM_WRITE_COMMAND, addr, data, len);
+        } else {
+            bus->Request(master_id, addr, OP_WRITE, len);
+            ok = bus->WaitForAcknowledge(master_id);
+            if (ok) {
+                bus->WriteBurst(data, len);
+            }
+        }
+        if (!ok) {
+            access_failed("write", addr, len);
+        }
+    }
+
+    // read len words at addr, DRAM reads go out as split reads if enabled
+    void bus_read(unsigned int addr, unsigned int *data, unsigned int len) {
+        bool ok;
+        if (master_socket.size() > 0) {
+            ok = lt_transport(master_socket, qk, tlm::TLM_READ_COMMAND, addr, data, len);
+        } else if (split_reads && addr >= DRAM_BASE_ADDR) {
+            unsigned int tag = bus->RequestRead(master_id, addr, len);
+            ok = bus->ReadResponse(tag, data, len);
+        } else {
+            bus->Request(master_id, addr, OP_READ, len);
+            ok = bus->WaitForAcknowledge(master_id);
+            if (ok) {
+                bus->ReadBurst(data, len);
+            }
+        }
+        if (!ok) {
+            access_failed("read", addr, len);
+        }
+    }
+
+    // the program cannot go on past an access the bus dropped, stop the run
+    void access_failed(const char *op, unsigned int addr, unsigned int len) {
+        std::ostringstream msg;
+        msg << "bus " << op << " of " << len << " words at " << addr << " failed";
+        SC_REPORT_ERROR(name(), msg.str().c_str());
+    }
 };
@@ -0,0 +1,218 @@
+/*************************************************************
+Golden_Model.cpp runs the network on the host with the
+reference implementation in golden_model.h, without SystemC,
+over any range of the MNIST test set and reports its accuracy
+and speed. It reads the weights and test set from the working
+directory like the simulator, or the weights from a DRAM image
+(-i) packed or not, so its predictions are those the simulator
+makes on the same weights.
+
+-c checks a per-image results CSV of the simulator (Proj_exec
+-R) against the golden predictions: every image of the CSV in
+the golden range is compared, the mismatches listed and the
+exit status is 1 if there are any, or if no image of the CSV
+was in the golden range.
+
+-o writes the golden predictions as a CSV of image, label,
+predicted and correct. -j sets the threads, every core by
+default.
+
+Build with make golden, -ffp-contract=off keeps the results
+bit exact with the simulator's. The target sets no -march so
+the binary runs, with the same results, on any host of the
+architecture.
+
+Usage: ./golden_model [-i image] [-n [first:]count] [-j threads]
+                      [-c sim_results.csv] [-o predictions.csv]
+*************************************************************/
+
+#define EIE_NO_SYSTEMC
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+#include <project_include.h>
+#include "dram_image.h"
+#include "golden_model.h"
+
+#define GOLDEN_MAX_MISMATCHES_SHOWN 20
+
+static void usage() {
+	std::cout << "Usage: ./golden_model [-i image] [-n [first:]count] [-j threads]" << std::endl
+	          << "                      [-c sim_results.csv] [-o predictions.csv]" << std::endl;
+}
+
+// "[first:]count" into first and count, false if malformed
+static bool parse_range(const std::string &arg, unsigned int &first, unsigned int &count) {
+	size_t colon = arg.find(':');
+	char *end = NULL;
+	if (colon != std::string::npos) {
+		first = (unsigned int) strtoul(arg.substr(0, colon).c_str(), &end, 10);
+		if (colon == 0 || *end != '\0') {
+			return false;
+		}
+	}
+	std::string rest = (colon == std::string::npos) ? arg : arg.substr(colon + 1);
+	count = (unsigned int) strtoul(rest.c_str(), &end, 10);
+	return !rest.empty() && *end == '\0' && count > 0;
+}
+
+/*
+Compare the simulator's results CSV at path against the golden predictions of the images
+from first on. Returns the mismatches, or -1 if the file cannot be read or no result was
+compared.
+*/
+static int check_results(const std::string &path, unsigned int first, const std::vector<unsigned int> &labels,
+                         const std::vector<unsigned int> &predicted) {
+	std::ifstream in(path.c_str());
+	if (!in) {
+		std::cout << "ERROR: CANNOT OPEN " << path << std::endl;
+		return -1;
+	}
+	std::string line;
+	std::getline(in, line);
+	unsigned int checked = 0, outside = 0, mismatches = 0;
+	while (std::getline(in, line)) {
+		unsigned int image, label, pred;
+		if (sscanf(line.c_str(), "%u,%u,%u", &image, &label, &pred) != 3) {
+			continue;
+		}
+		if (image < first || image - first >= predicted.size()) {
+			outside++;
+			continue;
+		}
+		unsigned int k = image - first;
+		checked++;
+		if (label != labels[k] || pred != predicted[k]) {
+			if (mismatches < GOLDEN_MAX_MISMATCHES_SHOWN) {
+				std::cout << "MISMATCH image " << image << ": simulator label " << label << " predicted " << pred
+				          << ", golden label " << labels[k] << " predicted " << predicted[k] << std::endl;
+			}
+			mismatches++;
+		}
+	}
+	std::cout << "Checked " << checked << " simulator results against the golden model: " << mismatches
+	          << " mismatches";
+	if (outside > 0) {
+		std::cout << ", " << outside << " outside the golden range skipped";
+	}
+	std::cout << std::endl;
+	if (checked == 0) {
+		std::cout << "ERROR: NO SIMULATOR RESULT IN " << path << " IS IN THE GOLDEN RANGE" << std::endl;
+		return -1;
+	}
+	return (int) mismatches;
+}
+
+int main(int argc, char *argv[]) {
+	std::string image_path, check_path, output_path;
+	unsigned int first = 0, count = 0;
+	unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+	for (int arg = 1; arg < argc; arg++) {
+		std::string flag(argv[arg]);
+		bool has_value = arg + 1 < argc;
+		if (flag == "-i" && has_value) {
+			image_path = argv[++arg];
+		} else if (flag == "-n" && has_value) {
+			if (!parse_range(argv[++arg], first, count)) {
+				usage();
+				return 1;
+			}
+		} else if (flag == "-j" && has_value) {
+			threads = (unsigned int) atoi(argv[++arg]);
+			if (threads == 0) {
+				usage();
+				return 1;
+			}
+		} else if (flag == "-c" && has_value) {
+			check_path = argv[++arg];
+		} else if (flag == "-o" && has_value) {
+			output_path = argv[++arg];
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	//the weights are read into a DRAM-sized buffer exactly as the simulator preloads them
+	void *store = mmap(NULL, (size_t) DRAM_SIZE * sizeof(unsigned int), PROT_READ | PROT_WRITE,
+	                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (store == MAP_FAILED) {
+		std::cout << "ERROR: CANNOT RESERVE " << DRAM_SIZE << " WORDS" << std::endl;
+		return 1;
+	}
+	unsigned int *mem = (unsigned int *) store;
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<dram_region> regions;
+	std::string error;
+	if (!image_path.empty()) {
+		if (!map_dram_image(image_path, mem, DRAM_SIZE, regions, error)) {
+			std::cout << "ERROR: " << error << std::endl;
+			return 1;
+		}
+	} else if (!preload_weights(mem, DRAM_SIZE, regions, error)) {
+		std::cout << "ERROR: " << error << std::endl;
+		return 1;
+	}
+	golden_model model;
+	if (!model.load(mem, regions, error)) {
+		std::cout << "ERROR: " << error << std::endl;
+		return 1;
+	}
+	munmap(store, (size_t) DRAM_SIZE * sizeof(unsigned int));
+
+	mnist_reader reader;
+	if (!reader.open(first)) {
+		std::cout << "ERROR: MNIST/ HOLDS " << reader.images << " TEST IMAGES, NONE FROM IMAGE " << first << std::endl;
+		return 1;
+	}
+	if (count == 0 || count > reader.images - first) {
+		count = reader.images - first;
+	}
+	std::vector<unsigned int> images((size_t) count * MNIST_IMAGE_WORDS);
+	std::vector<unsigned int> labels(count), predicted(count);
+	for (unsigned int k = 0; k < count; k++) {
+		if (!reader.next(&images[(size_t) k * MNIST_IMAGE_WORDS])) {
+			std::cout << "ERROR: CANNOT READ TEST IMAGE " << first + k << std::endl;
+			return 1;
+		}
+		labels[k] = images[(size_t) k * MNIST_IMAGE_WORDS + 28 * 28];
+	}
+	auto loaded = std::chrono::steady_clock::now();
+
+	model.classify(images.data(), count, predicted.data(), threads);
+	auto done = std::chrono::steady_clock::now();
+
+	unsigned int good = 0;
+	for (unsigned int k = 0; k < count; k++) {
+		good += (predicted[k] == labels[k]) ? 1 : 0;
+	}
+	double load_s = std::chrono::duration<double>(loaded - start).count();
+	double run_s = std::chrono::duration<double>(done - loaded).count();
+	std::cout << "Golden model: " << count << " images from " << first << " on " << threads << " threads" << std::endl;
+	std::cout << "Accuracy: " << (double) good / count << " (" << good << "/" << count << ")" << std::endl;
+	std::cout << "Load: " << load_s << " s, inference: " << run_s << " s, " << count / run_s << " images/s" << std::endl;
+
+	if (!output_path.empty()) {
+		csv_sink out;
+		if (!out.open(output_path, "image,label,predicted,correct")) {
+			return 1;
+		}
+		for (unsigned int k = 0; k < count; k++) {
+			out.row() << first + k << "," << labels[k] << "," << predicted[k] << "," << (predicted[k] == labels[k] ? 1 : 0);
+			out.end_row();
+		}
+	}
+
+	if (!check_path.empty()) {
+		int mismatches = check_results(check_path, first, labels, predicted);
+		return (mismatches == 0) ? 0 : 1;
+	}
+	return 0;
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+/*************************************************************
+Golden_Model.h is a reference implementation of the network
+the simulator runs, free of SystemC, for accuracy runs over
+the whole test set in seconds and for checking the
+simulator's predictions image by image (golden_model.cpp).
+
+SEMANTICS:
+	The arithmetic of EIE_accelerator and the central
+	control: float weights and pixels widened to double,
+	every output the double sum in input order of weight
+	times input over the non-zero inputs, then ReLU (the last
+	layer included), and the prediction the first index of
+	the largest output. The results match the simulator bit
+	for bit as long as the compiler does not contract the
+	multiply and add into an FMA, so the model is built with
+	-ffp-contract=off (make golden).
+
+BATCHED GEMV:
+	classify() runs the images in blocks of GOLDEN_BATCH. A
+	layer is stored in panels of GOLDEN_PANEL_ROWS rows, the
+	weights of one input for the rows of a panel next to each
+	other, and for every panel and group of
+	GOLDEN_PANEL_IMAGES images of the block the outputs are
+	kept in registers while the inputs are walked once: a
+	vector of weights times input j of each image. Every
+	output still sums in input order, so the loop vectorises
+	across rows and images without reassociating a sum, and a
+	pass over the weights serves the whole block.
+
+	Zero inputs are not skipped as the accelerator does: their
+	products are zeros and an output that starts at +0 never
+	changes by adding a zero, so the sums are the same for any
+	finite weights.
+
+WEIGHTS:
+	Taken from DRAM contents: the text files parsed by
+	preload_weights() or a DRAM image from dram_image_convert.
+	Packed layers are unpacked with weight_codec.h, so the
+	model runs on the same lossy shared weights as the
+	simulator.
+
+THREADS:
+	The blocks are spread over the cores with parallel_for
+	(dram_preload.h), each block with its own activations.
+*************************************************************/
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <project_include.h>
+#include "dram_preload.h"
+#include "weight_codec.h"
+
+#define GOLDEN_BATCH 64
+#define GOLDEN_PANEL_ROWS 16
+#define GOLDEN_PANEL_IMAGES 4
+
+class golden_model {
+private:
+    unsigned int sizes[NUM_LAYERS + 1] = LAYER_SIZES;
+    unsigned int stride; // doubles per image in the activation buffers
+
+    /*
+    Layer i in panels of GOLDEN_PANEL_ROWS rows, the last padded with zero rows. Within a
+    panel the weights of one input are next to each other: the weight of row r for input j
+    at (r / GOLDEN_PANEL_ROWS * cols + j) * GOLDEN_PANEL_ROWS + r % GOLDEN_PANEL_ROWS.
+    */
+    std::vector<float> weights[NUM_LAYERS];
+
+    static unsigned int round_up(unsigned int n, unsigned int to) {
+        return (n + to - 1) / to * to;
+    }
+
+    size_t buffer_size() const {
+        return (size_t) round_up(GOLDEN_BATCH, GOLDEN_PANEL_IMAGES) * stride;
+    }
+
+    void set_layer(unsigned int i, const float *dense) {
+        unsigned int rows = sizes[i + 1], cols = sizes[i];
+        weights[i].assign((size_t) round_up(rows, GOLDEN_PANEL_ROWS) * cols, 0.0f);
+        for (unsigned int r = 0; r < rows; r++) {
+            float *panel = &weights[i][(size_t) (r / GOLDEN_PANEL_ROWS) * cols * GOLDEN_PANEL_ROWS];
+            for (unsigned int j = 0; j < cols; j++) {
+                panel[(size_t) j * GOLDEN_PANEL_ROWS + r % GOLDEN_PANEL_ROWS] = dense[(size_t) r * cols + j];
+            }
+        }
+    }
+
+    // predict the n images at images into predicted, in and out hold buffer_size() doubles each
+    void forward(const unsigned int *images, unsigned int n, unsigned int *predicted, double *in, double *out) const {
+        // images past n in the last group of GOLDEN_PANEL_IMAGES are zeros, computed and dropped
+        unsigned int padded = round_up(n, GOLDEN_PANEL_IMAGES);
+        std::fill(in, in + (size_t) padded * stride, 0.0);
+        for (unsigned int k = 0; k < n; k++) {
+            const float *pixels = (const float *) &images[(size_t) k * MNIST_IMAGE_WORDS];
+            for (unsigned int j = 0; j < sizes[0]; j++) {
+                in[(size_t) k * stride + j] = (double) pixels[j];
+            }
+        }
+
+        for (unsigned int i = 0; i < NUM_LAYERS; i++) {
+            unsigned int panels = (sizes[i + 1] + GOLDEN_PANEL_ROWS - 1) / GOLDEN_PANEL_ROWS, cols = sizes[i];
+            for (unsigned int p = 0; p < panels; p++) {
+                const float *panel = &weights[i][(size_t) p * cols * GOLDEN_PANEL_ROWS];
+                for (unsigned int k = 0; k < padded; k += GOLDEN_PANEL_IMAGES) {
+                    // the outputs of a panel for a group of images stay in registers over the whole row
+                    double acc[GOLDEN_PANEL_IMAGES][GOLDEN_PANEL_ROWS] = {};
+                    const double *x = in + (size_t) k * stride;
+                    for (unsigned int j = 0; j < cols; j++) {
+                        const float *w = panel + (size_t) j * GOLDEN_PANEL_ROWS;
+#pragma GCC unroll 16
+                        for (unsigned int kk = 0; kk < GOLDEN_PANEL_IMAGES; kk++) {
+                            double xj = x[(size_t) kk * stride + j];
+#pragma GCC unroll 16
+                            for (unsigned int rr = 0; rr < GOLDEN_PANEL_ROWS; rr++) {
+                                acc[kk][rr] += (double) w[rr] * xj;
+                            }
+                        }
+                    }
+                    for (unsigned int kk = 0; kk < GOLDEN_PANEL_IMAGES; kk++) {
+                        double *result = out + (size_t) (k + kk) * stride + p * GOLDEN_PANEL_ROWS;
+                        for (unsigned int rr = 0; rr < GOLDEN_PANEL_ROWS; rr++) {
+                            result[rr] = std::max(0.0, acc[kk][rr]);
+                        }
+                    }
+                }
+            }
+            std::swap(in, out);
+        }
+
+        for (unsigned int k = 0; k < n; k++) {
+            const double *result = in + (size_t) k * stride;
+            unsigned int maxidx = 0;
+            for (unsigned int r = 1; r < sizes[NUM_LAYERS]; r++) {
+                if (result[r] > result[maxidx]) {
+                    maxidx = r;
+                }
+            }
+            predicted[k] = maxidx;
+        }
+    }
+
+public:
+    golden_model() {
+        stride = round_up(*std::max_element(sizes, sizes + NUM_LAYERS + 1), GOLDEN_PANEL_ROWS);
+    }
+
+    /*
+    Take the weights from DRAM contents at mem laid out as regions says (weight_l<i>, and
+    weight_dir when they are packed). False with error set if a layer is missing or its
+    size does not match LAYER_SIZES.
+    */
+    bool load(const unsigned int *mem, const std::vector<dram_region> &regions, std::string &error) {
+        bool packed = false;
+        for (unsigned int i = 0; i < regions.size(); i++) {
+            packed = packed || regions[i].name == "weight_dir";
+        }
+        std::vector<float> dense;
+        for (unsigned int i = 0; i < NUM_LAYERS; i++) {
+            std::string name("weight_l" + std::to_string(i));
+            const dram_region *r = NULL;
+            for (unsigned int k = 0; k < regions.size() && r == NULL; k++) {
+                r = (regions[k].name == name) ? &regions[k] : NULL;
+            }
+            unsigned int n = sizes[i] * sizes[i + 1];
+            if (r == NULL) {
+                error = "no " + name + " region";
+                return false;
+            }
+            if (packed) {
+                dense.resize(n);
+                if (unpack_layer(mem + r->offset, r->words, dense.data(), n) == 0 && n > 0) {
+                    error = name + " has no codebook";
+                    return false;
+                }
+                set_layer(i, dense.data());
+            } else if (r->words != n) {
+                error = name + " holds " + std::to_string(r->words) + " weights, LAYER_SIZES expects " + std::to_string(n);
+                return false;
+            } else {
+                set_layer(i, (const float *) (mem + r->offset));
+            }
+        }
+        return true;
+    }
+
+    // predict the n images of MNIST_IMAGE_WORDS words at images into predicted on up to threads threads
+    void classify(const unsigned int *images, unsigned int n, unsigned int *predicted, unsigned int threads) const {
+        unsigned int blocks = (n + GOLDEN_BATCH - 1) / GOLDEN_BATCH;
+        parallel_for(blocks, std::max(1u, threads), [&](unsigned int b) {
+            unsigned int first = b * GOLDEN_BATCH;
+            unsigned int count = std::min((unsigned int) GOLDEN_BATCH, n - first);
+            std::vector<double> in(buffer_size()), out(buffer_size());
+            forward(images + (size_t) first * MNIST_IMAGE_WORDS, count, predicted + first, in.data(), out.data());
+        });
+    }
+};
@@ -0,0 +1,212 @@
+#pragma once
+
+/*************************************************************
+Sim_Log.h is the logging of the simulation modules: messages
+with a level and the category of the module that logs them,
+and a buffered CSV sink for per-image results.
+
+LEVELS:
+	Error, warn, info, debug and trace (LOG_LEVEL_ERROR to
+	LOG_LEVEL_TRACE, 0 to 4), logged with LOG_ERROR() to
+	LOG_TRACE(). Levels above SIM_LOG_LEVEL (project_include.h)
+	are compiled out, their macros expand to nothing and their
+	arguments are never evaluated. The default keeps every
+	level up to LOG_DEBUG; build with -DSIM_LOG_LEVEL=4 for the
+	bus handshake traces. Of the levels compiled in, those up
+	to sim_log::level are printed, LOG_WARN unless -v (info)
+	or -vv (debug) is given.
+
+CATEGORIES:
+	Every module logs under its own category and
+	sim_log::categories masks them at run time (-L sw,cc,...).
+	Errors are printed whatever the mask.
+
+FORMAT:
+	One line per message on stdout, "[<time>] <LEVEL> <cat>:
+	<message>", written without flushing so a long run does
+	not pay a terminal flush per line. Built with
+	EIE_NO_SYSTEMC (tools sharing the DRAM preload without
+	SystemC) the time is left out.
+
+CSV SINK:
+	csv_sink collects rows in memory and writes them out in
+	blocks of SIM_LOG_CSV_BUFFER bytes, the rest when it is
+	closed or destroyed.
+*************************************************************/
+
+#ifndef EIE_NO_SYSTEMC
+#include <systemc.h>
+#endif
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <project_include.h>
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+#define LOG_LEVEL_TRACE 4
+
+#define SIM_LOG_CSV_BUFFER (64 * 1024)
+
+enum log_category {
+    LOG_TOP = 1 << 0,
+    LOG_SW = 1 << 1,
+    LOG_CC = 1 << 2,
+    LOG_ACC = 1 << 3,
+    LOG_BUS = 1 << 4,
+    LOG_XBUS = 1 << 5,
+    LOG_DRAM = 1 << 6,
+    LOG_LOADER = 1 << 7,
+    LOG_ALL = 0xff
+};
+
+struct sim_log {
+    // run-time level and category mask, shared by every module
+    static int &level() {
+        static int current = LOG_LEVEL_WARN;
+        return current;
+    }
+
+    static unsigned int &categories() {
+        static unsigned int mask = LOG_ALL;
+        return mask;
+    }
+
+    static bool enabled(int lvl, unsigned int cat) {
+        return lvl <= level() && (lvl == LOG_LEVEL_ERROR || (categories() & cat) != 0);
+    }
+
+    static const char *level_name(int lvl) {
+        static const char *names[] = {"ERROR", "WARN", "INFO", "DEBUG", "TRACE"};
+        return (lvl >= 0 && lvl <= LOG_LEVEL_TRACE) ? names[lvl] : "?";
+    }
+
+    static const char *category_name(unsigned int cat) {
+        static const char *names[] = {"top", "sw", "cc", "acc", "bus", "xbus", "dram", "loader"};
+        for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            if (cat == (1u << i)) {
+                return names[i];
+            }
+        }
+        return "?";
+    }
+
+    // comma-separated category names or "all", false on an unknown name
+    static bool parse_categories(const std::string &list, unsigned int &mask) {
+        std::stringstream in(list);
+        std::string name;
+        mask = 0;
+        while (std::getline(in, name, ',')) {
+            unsigned int found = (name == "all") ? (unsigned int) LOG_ALL : 0;
+            for (unsigned int i = 0; i < 8 && found == 0; i++) {
+                found = (name == category_name(1u << i)) ? (1u << i) : 0;
+            }
+            if (found == 0) {
+                return false;
+            }
+            mask |= found;
+        }
+        return mask != 0;
+    }
+
+    static void write(int lvl, unsigned int cat, const std::string &message) {
+#ifndef EIE_NO_SYSTEMC
+        std::cout << "[" << sc_time_stamp() << "] ";
+#endif
+        std::cout << level_name(lvl) << " " << category_name(cat) << ": " << message << '\n';
+    }
+};
+
+#define SIM_LOG_AT(lvl, cat, expr)                        \
+    do {                                                  \
+        if (sim_log::enabled(lvl, cat)) {                 \
+            std::ostringstream sim_log_line;              \
+            sim_log_line << expr;                         \
+            sim_log::write(lvl, cat, sim_log_line.str()); \
+        }                                                 \
+    } while (0)
+
+#define LOG_ERROR(cat, expr) SIM_LOG_AT(LOG_LEVEL_ERROR, cat, expr)
+
+#if SIM_LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(cat, expr) SIM_LOG_AT(LOG_LEVEL_WARN, cat, expr)
+#else
+#define LOG_WARN(cat, expr) ((void) 0)
+#endif
+
+#if SIM_LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(cat, expr) SIM_LOG_AT(LOG_LEVEL_INFO, cat, expr)
+#else
+#define LOG_INFO(cat, expr) ((void) 0)
+#endif
+
+#if SIM_LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(cat, expr) SIM_LOG_AT(LOG_LEVEL_DEBUG, cat, expr)
+#else
+#define LOG_DEBUG(cat, expr) ((void) 0)
+#endif
+
+#if SIM_LOG_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_TRACE(cat, expr) SIM_LOG_AT(LOG_LEVEL_TRACE, cat, expr)
+#else
+#define LOG_TRACE(cat, expr) ((void) 0)
+#endif
+
+// rows of comma-separated values, buffered in memory and written out in blocks
+class csv_sink {
+private:
+    std::ofstream out;
+    std::string buffer;
+    std::ostringstream row_stream;
+
+    void flush_buffer() {
+        out.write(buffer.data(), (std::streamsize) buffer.size());
+        buffer.clear();
+    }
+
+public:
+    // open path and write the header line, false if it cannot be created
+    bool open(const std::string &path, const std::string &header) {
+        out.open(path.c_str(), std::ios::out | std::ios::trunc);
+        if (!out) {
+            LOG_ERROR(LOG_TOP, "CANNOT CREATE " << path);
+            return false;
+        }
+        buffer.reserve(SIM_LOG_CSV_BUFFER);
+        buffer += header;
+        buffer += '\n';
+        return true;
+    }
+
+    bool is_open() const {
+        return out.is_open();
+    }
+
+    // start a row, stream the fields with their commas into it and finish it with end_row()
+    std::ostream &row() {
+        row_stream.str("");
+        return row_stream;
+    }
+
+    void end_row() {
+        buffer += row_stream.str();
+        buffer += '\n';
+        if (buffer.size() >= SIM_LOG_CSV_BUFFER) {
+            flush_buffer();
+        }
+    }
+
+    void close() {
+        if (out.is_open()) {
+            flush_buffer();
+            out.close();
+        }
+    }
+
+    ~csv_sink() {
+        close();
+    }
+};
@@ -0,0 +1,250 @@
+#pragma once
+
+/*************************************************************
+TLM_Bus.h is a loosely-timed TLM-2.0 model of the on-chip bus
+and the alternative to bus_clocked for design space sweeps.
+Initiators (the CPU and the CC's DMA) call b_transport on
+their sockets with a generic payload and the bus forwards it
+to the target whose address range holds it (the CC status
+registers or the Cross_Bus in front of the DRAM). Nothing is
+clocked: every hop adds its latency to the annotated delay
+and each initiator runs ahead of simulation time until its
+quantum keeper tells it to synchronise.
+
+Payload addresses are word addresses, the same ones used on
+bus_clocked, and the data length is in bytes (4 per word).
+
+ADDRESS MAP:
+	Targets are registered with map_target() during
+	elaboration, in the order they were bound to init_socket.
+	Overlapping ranges are an elaboration error. A transaction
+	outside every range, or crossing the end of one, gets
+	TLM_ADDRESS_ERROR_RESPONSE.
+
+TIMING:
+	A transaction costs the handshake of the pin-level bus
+	(request, grant and acknowledge, handshake_cycles) plus
+	the first-beat latency (two cycles for reads, one for
+	writes) and one cycle per further beat of data_width bits.
+	The bus is held until the target has annotated its own
+	latency, like the blocking pin-level protocol, and a
+	transaction that starts while the bus is still held waits
+	until it is free. Initiators do not interleave inside a
+	quantum, which is what makes the model loosely timed.
+
+DIRECT MEMORY INTERFACE:
+	DMI requests are forwarded to the target of the address
+	and the granted range is clipped to that target's range.
+	The bus adds nothing to the DMI latency. An initiator that
+	copies a burst through DMI charges the bus and the target
+	afterwards with a TLM_IGNORE_COMMAND transaction of the
+	same length, which costs the same as a read but moves no
+	data, so timing, contention and tallies are unchanged.
+	Invalidations from a target are passed to every initiator.
+
+TRACING:
+	set_trace() records every transaction like bus_clocked
+	does, with the initiator's socket index as the master and
+	DMI charges recorded as reads.
+
+POWER MODELLING:
+	Same as bus_clocked: each 32-bit word moved is one 1 pJ
+	transfer in tally_bus_transfers.
+*************************************************************/
+
+#include <systemc.h>
+#include <tlm.h>
+#include <tlm_utils/multi_passthrough_initiator_socket.h>
+#include <tlm_utils/multi_passthrough_target_socket.h>
+#include <tlm_utils/tlm_quantumkeeper.h>
+#include <project_include.h>
+#include "bus_trace.h"
+#include "sim_log.h"
+#include <sstream>
+#include <vector>
+
+class tlm_bus : public sc_module {
+private:
+    struct target_range {
+        unsigned int base;
+        unsigned int size;
+        int port;
+    };
+    std::vector<target_range> address_map;
+
+    sc_time clk_period;
+    sc_time free_at; // end of the last transaction on the bus
+    unsigned int words_per_beat;
+    unsigned int handshake_cycles;
+
+    bus_trace_writer *trace;
+
+    // range of the target holding [addr, addr + len), NULL if there is none
+    const target_range *decode_range(unsigned int addr, unsigned int len) const {
+        for (unsigned int i = 0; i < address_map.size(); i++) {
+            const target_range &r = address_map[i];
+            if (addr >= r.base && addr - r.base < r.size) {
+                return (len <= r.size - (addr - r.base)) ? &r : NULL;
+            }
+        }
+        return NULL;
+    }
+
+    int decode(unsigned int addr, unsigned int len) const {
+        const target_range *r = decode_range(addr, len);
+        return r ? r->port : -1;
+    }
+
+public:
+    // initiators bind to targ_socket, targets to init_socket
+    tlm_utils::multi_passthrough_target_socket<tlm_bus> targ_socket;
+    tlm_utils::multi_passthrough_initiator_socket<tlm_bus> init_socket;
+
+    unsigned int tally_bus_transfers;
+    unsigned int tally_bus_beats;
+    sc_time busy_time;
+
+    tlm_bus(sc_module_name name, unsigned int data_width = BUS_DATA_WIDTH, unsigned int handshake = 4)
+        : sc_module(name)
+        , targ_socket("targ_socket")
+        , init_socket("init_socket") {
+        clk_period = sc_time(INT_CLK_PERIOD_NS, SC_NS);
+        handshake_cycles = handshake;
+        tally_bus_transfers = 0;
+        tally_bus_beats = 0;
+        busy_time = SC_ZERO_TIME;
+        free_at = SC_ZERO_TIME;
+        trace = NULL;
+
+        if (data_width != 32 && data_width != 64 && data_width != 128 && data_width != 256) {
+            LOG_ERROR(LOG_BUS, "UNSUPPORTED BUS WIDTH " << data_width << ", USING 32 BITS");
+            data_width = 32;
+        }
+        words_per_beat = data_width / 32;
+
+        targ_socket.register_b_transport(this, &tlm_bus::b_transport);
+        targ_socket.register_transport_dbg(this, &tlm_bus::transport_dbg);
+        targ_socket.register_get_direct_mem_ptr(this, &tlm_bus::get_direct_mem_ptr);
+        init_socket.register_invalidate_direct_mem_ptr(this, &tlm_bus::invalidate_direct_mem_ptr);
+    }
+
+    void map_target(int port, unsigned int base, unsigned int size) {
+        for (unsigned int i = 0; i < address_map.size(); i++) {
+            const target_range &r = address_map[i];
+            if (base < r.base + r.size && r.base < base + size) {
+                std::ostringstream msg;
+                msg << "target range " << base << "+" << size << " overlaps target " << r.port
+                    << " at " << r.base << "+" << r.size;
+                SC_REPORT_ERROR(name(), msg.str().c_str());
+                return;
+            }
+        }
+        target_range r;
+        r.base = base;
+        r.size = size;
+        r.port = port;
+        address_map.push_back(r);
+    }
+
+    void set_trace(bus_trace_writer *w) {
+        trace = w;
+    }
+
+    unsigned int data_width() const {
+        return words_per_beat * 32;
+    }
+
+    void b_transport(int id, tlm::tlm_generic_payload &trans, sc_time &delay) {
+        unsigned int addr = (unsigned int) trans.get_address();
+        unsigned int len = trans.get_data_length() / sizeof(unsigned int);
+        int port = decode(addr, len);
+        if (port < 0) {
+            trans.set_response_status(tlm::TLM_ADDRESS_ERROR_RESPONSE);
+            return;
+        }
+
+        // wait for the bus if another initiator holds it at this local time
+        sc_time requested = sc_time_stamp() + delay;
+        sc_time start = requested;
+        if (start < free_at) {
+            delay += free_at - start;
+            start = free_at;
+        }
+
+        unsigned int beats = (len + words_per_beat - 1) / words_per_beat;
+        unsigned int first_beat = trans.is_write() ? 1 : 2;
+        delay += clk_period * (double) (handshake_cycles + first_beat + beats - 1);
+
+        init_socket[port]->b_transport(trans, delay);
+
+        free_at = sc_time_stamp() + delay;
+        busy_time += free_at - start;
+        tally_bus_transfers += len;
+        tally_bus_beats += beats;
+
+        if (trace != NULL) {
+            trace->record(bus_trace_make((unsigned int) id, trans.is_write() ? OP_WRITE : OP_READ, 0, addr, len,
+                                         requested, start, free_at, clk_period));
+        }
+    }
+
+    unsigned int transport_dbg(int /*id*/, tlm::tlm_generic_payload &trans) {
+        int port = decode((unsigned int) trans.get_address(), trans.get_data_length() / sizeof(unsigned int));
+        if (port < 0) {
+            return 0;
+        }
+        return init_socket[port]->transport_dbg(trans);
+    }
+
+    bool get_direct_mem_ptr(int /*id*/, tlm::tlm_generic_payload &trans, tlm::tlm_dmi &dmi) {
+        const target_range *r = decode_range((unsigned int) trans.get_address(), 1);
+        if (r == NULL || !init_socket[r->port]->get_direct_mem_ptr(trans, dmi)) {
+            return false;
+        }
+        if (dmi.get_start_address() < r->base) {
+            dmi.set_dmi_ptr(dmi.get_dmi_ptr() + (r->base - dmi.get_start_address()) * sizeof(unsigned int));
+            dmi.set_start_address(r->base);
+        }
+        if (dmi.get_end_address() > (sc_dt::uint64) r->base + r->size - 1) {
+            dmi.set_end_address((sc_dt::uint64) r->base + r->size - 1);
+        }
+        return true;
+    }
+
+    void invalidate_direct_mem_ptr(int /*id*/, sc_dt::uint64 start, sc_dt::uint64 end) {
+        for (unsigned int i = 0; i < targ_socket.size(); i++) {
+            targ_socket[i]->invalidate_direct_mem_ptr(start, end);
+        }
+    }
+};
+
+/*
+Blocking transport of len words for a loosely-timed initiator. The transaction starts at
+the initiator's local time, the annotated delay becomes its new local time and the thread
+only yields to the kernel once the quantum is used up.
+*/
+template <typename SOCKET>
+bool lt_transport(SOCKET &socket, tlm_utils::tlm_quantumkeeper &qk, tlm::tlm_command cmd, unsigned int addr, unsigned int *data, unsigned int len) {
+    tlm::tlm_generic_payload trans;
+    trans.set_command(cmd);
+    trans.set_address(addr);
+    trans.set_data_ptr((unsigned char *) data);
+    trans.set_data_length(len * sizeof(unsigned int));
+    trans.set_streaming_width(len * sizeof(unsigned int));
+    trans.set_byte_enable_ptr(0);
+    trans.set_dmi_allowed(false);
+    trans.set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+
+    sc_time delay = qk.get_local_time();
+    socket->b_transport(trans, delay);
+    qk.set(delay);
+    if (qk.need_sync()) {
+        qk.sync();
+    }
+
+    if (trans.is_response_error()) {
+        LOG_ERROR(LOG_BUS, "TLM TRANSACTION AT " << addr << " FAILED (" << trans.get_response_string() << ")");
+        return false;
+    }
+    return true;
+}
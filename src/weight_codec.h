@@ -0,0 +1,155 @@
+#pragma once
+
+/*************************************************************
+Weight_Codec.h is the packed weight format of the DRAM: the
+dense floats of a layer replaced by a codebook of shared
+weights and a run-length coded stream of codebook indices, as
+in the EIE paper. dram_image_convert packs the weights offline
+and the central control unpacks them as they arrive in its
+EIE_CC_OP_WRITE_WEIGHT handler.
+
+FORMAT OF A LAYER:
+	WEIGHT_CODEBOOK_SIZE words of codebook, floats, entry 0
+	is always 0.0. Then the entries, four to a word from the
+	least significant byte up. An entry is a byte with the
+	number of zeros before the weight (the relative index)
+	in its upper four bits and the weight's codebook index in
+	the lower four. A run of more than WEIGHT_MAX_RUN zeros is
+	broken by an explicit zero, an entry with index 0. The
+	trailing zeros of a layer are not coded, nor are the
+	unused entries of the last word, which decode to zeros
+	past the end. A layer is its rows one after the other, as
+	in the dense layout.
+
+DIRECTORY:
+	A packed image starts with WEIGHT_DIR_WORDS words: the
+	offset and the length in words of every layer, then the
+	offset of the test set, all from DRAM_BASE_ADDR. The CPU
+	reads it to find the layers and passes each length on to
+	the central control.
+
+CODEBOOK:
+	The shared weights are found by k-means over the weights
+	of the layer, linearly initialised between the smallest
+	and largest weight, with entry 0 held at zero so weights
+	closer to zero than to any other shared weight become
+	zeros of the stream. Weights smaller in magnitude than
+	the prune threshold are zeroed before clustering. The
+	packing is lossy, each weight becomes its shared weight.
+*************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <project_include.h>
+
+#define WEIGHT_CODEBOOK_SIZE 16
+#define WEIGHT_MAX_RUN 15
+#define WEIGHT_KMEANS_ITERATIONS 32
+#define WEIGHT_DIR_WORDS (2 * NUM_LAYERS + 1)
+
+// index of the codebook entry closest to v
+inline unsigned int nearest_code(const float *codebook, float v) {
+    unsigned int best = 0;
+    for (unsigned int j = 1; j < WEIGHT_CODEBOOK_SIZE; j++) {
+        if (std::fabs(codebook[j] - v) < std::fabs(codebook[best] - v)) {
+            best = j;
+        }
+    }
+    return best;
+}
+
+// cluster the n weights at w into the shared weights of codebook[WEIGHT_CODEBOOK_SIZE]
+inline void build_codebook(const float *w, unsigned int n, float prune, float *codebook) {
+    float lo = 0, hi = 0;
+    bool any = false;
+    for (unsigned int k = 0; k < n; k++) {
+        if (std::fabs(w[k]) >= prune && w[k] != 0) {
+            lo = any ? std::min(lo, w[k]) : w[k];
+            hi = any ? std::max(hi, w[k]) : w[k];
+            any = true;
+        }
+    }
+    codebook[0] = 0;
+    for (unsigned int j = 1; j < WEIGHT_CODEBOOK_SIZE; j++) {
+        codebook[j] = lo + (hi - lo) * (float) (j - 1) / (float) (WEIGHT_CODEBOOK_SIZE - 2);
+    }
+    if (!any) {
+        return;
+    }
+
+    std::vector<unsigned int> code(n, WEIGHT_CODEBOOK_SIZE);
+    for (unsigned int it = 0; it < WEIGHT_KMEANS_ITERATIONS; it++) {
+        double sum[WEIGHT_CODEBOOK_SIZE] = {0};
+        unsigned int count[WEIGHT_CODEBOOK_SIZE] = {0};
+        bool changed = false;
+        for (unsigned int k = 0; k < n; k++) {
+            unsigned int c = (std::fabs(w[k]) < prune) ? 0 : nearest_code(codebook, w[k]);
+            changed = changed || c != code[k];
+            code[k] = c;
+            sum[c] += w[k];
+            count[c]++;
+        }
+        if (!changed) {
+            break;
+        }
+        for (unsigned int j = 1; j < WEIGHT_CODEBOOK_SIZE; j++) {
+            if (count[j] > 0) {
+                codebook[j] = (float) (sum[j] / count[j]);
+            }
+        }
+    }
+}
+
+// append the packed form of the n weights at w to out
+inline void pack_layer(const float *w, unsigned int n, float prune, std::vector<unsigned int> &out) {
+    float codebook[WEIGHT_CODEBOOK_SIZE];
+    build_codebook(w, n, prune, codebook);
+    for (unsigned int j = 0; j < WEIGHT_CODEBOOK_SIZE; j++) {
+        unsigned int word;
+        memcpy(&word, &codebook[j], sizeof(word));
+        out.push_back(word);
+    }
+
+    unsigned int run = 0, entries = 0;
+    for (unsigned int k = 0; k < n; k++) {
+        unsigned int c = (std::fabs(w[k]) < prune) ? 0 : nearest_code(codebook, w[k]);
+        if (c == 0 && run < WEIGHT_MAX_RUN) {
+            run++;
+            continue;
+        }
+        if (entries % 4 == 0) {
+            out.push_back(0);
+        }
+        out.back() |= ((run << 4) | c) << (8 * (entries % 4));
+        entries++;
+        run = 0;
+    }
+}
+
+/*
+Unpack the layer in the words words at in into the n floats at out. Returns the number of
+entries decoded, each one a codebook lookup, or 0 if there is no room for the codebook.
+*/
+inline unsigned int unpack_layer(const unsigned int *in, unsigned int words, float *out, unsigned int n) {
+    std::fill(out, out + n, 0.0f);
+    if (words < WEIGHT_CODEBOOK_SIZE) {
+        return 0;
+    }
+    float codebook[WEIGHT_CODEBOOK_SIZE];
+    memcpy(codebook, in, sizeof(codebook));
+
+    unsigned int pos = 0, entries = 0;
+    for (unsigned int i = WEIGHT_CODEBOOK_SIZE; i < words && pos < n; i++) {
+        for (unsigned int b = 0; b < 4 && pos < n; b++) {
+            unsigned int entry = (in[i] >> (8 * b)) & 0xff;
+            pos += entry >> 4;
+            if (pos < n) {
+                out[pos++] = codebook[entry & 0xf];
+            }
+            entries++;
+        }
+    }
+    return entries;
+}